@@ -0,0 +1,476 @@
+#include "archive.h"
+#include "decompressor.h"
+#include "blockPipeline.h"
+#include "mappedFile.h"
+#include "pipelineStats.h"
+#include "crc32c.h"
+#include "rskFormat.h"
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
+#include <stdexcept>
+#include <cerrno>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static std::runtime_error systemError(const std::string &what, const std::string &path) {
+    return std::runtime_error(what + " " + path + ": " + std::strerror(errno));
+}
+
+// Member name of an input path: '/' separated, without a leading '/', empty or "." components
+// ".." is refused, so every member extracts below the output directory
+static std::string memberName(const std::string &path) {
+    std::string name;
+    size_t start = 0;
+    while (start <= path.size()) {
+        size_t end = std::min(path.find('/', start), path.size());
+        std::string part = path.substr(start, end - start);
+        if (part == "..") throw std::runtime_error("Refusing to archive a path containing ..: " + path);
+        if (!part.empty() && part != ".") name += (name.empty() ? "" : "/") + part;
+        start = end + 1;
+    }
+    return name;
+}
+
+// Names read back from an archive must already be in the form memberName gives
+static bool isSafeName(const std::string &name) {
+    if (name.empty() || name.size() > MAX_MEMBER_NAME_LENGTH) return false;
+    size_t start = 0;
+    while (start <= name.size()) {
+        size_t end = std::min(name.find('/', start), name.size());
+        std::string part = name.substr(start, end - start);
+        if (part.empty() || part == "." || part == "..") return false;
+        start = end + 1;
+    }
+    return true;
+}
+
+struct Archive::CreateJob {
+    const std::vector<Segment> *segments;
+    std::vector<uint8_t> input;
+    std::vector<uint8_t> block;
+    std::vector<uint32_t> crcs;  // CRC32C of every segment
+};
+
+struct Archive::ExtractJob {
+    size_t block;
+    std::vector<uint8_t> decoded;
+};
+
+// mkdir -p
+static void makeDirectories(const std::string &path) {
+    for (size_t pos = 0; pos != std::string::npos;) {
+        pos = path.find('/', pos + 1);
+        std::string prefix = path.substr(0, pos);
+        if (mkdir(prefix.c_str(), 0755) != 0 && errno != EEXIST) throw systemError("Failed to create directory", prefix);
+    }
+}
+
+// Read length bytes at offset of the file at path
+// Files are opened per block, so archiving many files never holds more than a block's worth open
+static void readRange(const std::string &path, uint64_t offset, size_t length, uint8_t *out) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) throw systemError("Failed to open", path);
+    size_t done = 0;
+    while (done < length) {
+        ssize_t n = pread(fd, out + done, length - done, static_cast<off_t>(offset + done));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            int error = errno;
+            close(fd);
+            if (n == 0) throw std::runtime_error("File shrank while archiving: " + path);
+            errno = error;
+            throw systemError("Failed to read", path);
+        }
+        done += static_cast<size_t>(n);
+    }
+    close(fd);
+}
+
+// A plain path or an @list file naming one path per line
+void Archive::addInput(const std::string &path, std::vector<Source> &sources) {
+    if (path.empty() || path[0] != '@') {
+        Archive::addPath(path, memberName(path), true, sources);
+        return;
+    }
+    std::ifstream list(path.substr(1));
+    if (!list) throw std::runtime_error("Failed to open file list " + path.substr(1));
+    std::string line;
+    while (std::getline(list, line)) {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (!line.empty()) Archive::addPath(line, memberName(line), true, sources);
+    }
+}
+
+// Directories are walked in name order so the same tree always gives the same archive
+// Links found inside directories are followed to regular files only, linked directories are
+// skipped so a link cannot loop the walk
+void Archive::addPath(const std::string &path, const std::string &name, bool followLinks, std::vector<Source> &sources) {
+    struct stat info;
+    if ((followLinks ? stat(path.c_str(), &info) : lstat(path.c_str(), &info)) != 0) throw systemError("Failed to read", path);
+    if (S_ISLNK(info.st_mode) && (stat(path.c_str(), &info) != 0 || !S_ISREG(info.st_mode))) {
+        std::cerr << "Skipping link " << path << std::endl;
+        return;
+    }
+
+    if (S_ISDIR(info.st_mode)) {
+        DIR *dir = opendir(path.c_str());
+        if (!dir) throw systemError("Failed to open directory", path);
+        std::vector<std::string> entries;
+        while (dirent *entry = readdir(dir)) {
+            std::string entryName = entry->d_name;
+            if (entryName != "." && entryName != "..") entries.push_back(entryName);
+        }
+        closedir(dir);
+        std::sort(entries.begin(), entries.end());
+        std::string prefix = (path.empty() || path.back() == '/') ? path : path + "/";
+        for (const std::string &entry : entries)
+            Archive::addPath(prefix + entry, name.empty() ? entry : name + "/" + entry, false, sources);
+        return;
+    }
+    if (!S_ISREG(info.st_mode)) {
+        std::cerr << "Skipping " << path << ": not a regular file" << std::endl;
+        return;
+    }
+    if (name.empty()) throw std::runtime_error("No member name for " + path);
+    sources.push_back({path, {name, 0, static_cast<uint64_t>(info.st_size), 0}});
+}
+
+// Lay the members out back to back and cut the result into blocks
+// A member of a block or more starts a new block, so only its tail shares a block; smaller members
+// are packed together and may straddle two blocks
+std::vector<std::vector<Archive::Segment>> Archive::planBlocks(std::vector<Source> &sources, size_t blockSize) {
+    std::vector<std::vector<Segment>> blocks;
+    std::vector<Segment> current;
+    size_t fill = 0;
+    uint64_t offset = 0;
+    for (size_t i = 0; i < sources.size(); i++) {
+        Member &member = sources[i].member;
+        member.offset = offset;
+        offset += member.size;
+        if (member.size >= blockSize && fill > 0) {
+            blocks.push_back(std::move(current));
+            current.clear();
+            fill = 0;
+        }
+        for (uint64_t done = 0; done < member.size;) {
+            size_t length = static_cast<size_t>(std::min<uint64_t>(member.size - done, blockSize - fill));
+            current.push_back({i, done, length});
+            fill += length;
+            done += length;
+            if (fill == blockSize) {
+                blocks.push_back(std::move(current));
+                current.clear();
+                fill = 0;
+            }
+        }
+    }
+    if (fill > 0) blocks.push_back(std::move(current));
+    return blocks;
+}
+
+std::pair<size_t, size_t> Archive::Create(const std::string &archiveFile, const std::vector<std::string> &inputs,
+                                          const CompressionOptions &options) {
+    Compressor::checkOptions(options, "");
+
+    std::vector<Source> sources;
+    PipelineStats::measure(options.stats, Stage::Read, [&]() {
+        for (const std::string &input : inputs) Archive::addInput(input, sources);
+    });
+    if (sources.empty()) throw std::runtime_error("Nothing to archive");
+    std::unordered_set<std::string> names;
+    for (const Source &source : sources) {
+        if (source.member.name.size() > MAX_MEMBER_NAME_LENGTH)
+            throw std::runtime_error("Member name too long: " + source.member.name);
+        if (!names.insert(source.member.name).second)
+            throw std::runtime_error("Duplicate member name: " + source.member.name);
+    }
+    std::vector<std::vector<Segment>> plan = Archive::planBlocks(sources, options.blockSize);
+
+    std::ofstream out(archiveFile, std::ios::binary);
+    if (!out) throw std::runtime_error("Failed to create " + archiveFile);
+
+    // Same layout as an .rsk header, with a zero length extension
+    std::vector<uint8_t> header(RSK_ARCHIVE_MAGIC, RSK_ARCHIVE_MAGIC + 3);
+    header.push_back(RSK_VERSION);
+    putU32(header, static_cast<uint32_t>(options.blockSize));
+    putU32(header, 0);
+    out.write(reinterpret_cast<const char *>(header.data()), header.size());
+    if (!out) throw std::runtime_error("Failed writing archive header");
+
+    // The reader thread gathers the segments of each block, the workers compress it and take the
+    // CRCs of its segments, and the writer folds those into the member CRCs
+    std::vector<BlockIndexEntry> index;
+    uint64_t offset = header.size();
+    size_t nextRead = 0;
+    BlockPipeline<CreateJob>::run(
+        [&](CreateJob &job) {
+            if (nextRead == plan.size()) return false;
+            job.segments = &plan[nextRead++];
+            PipelineStats::Timer timer(options.stats, Stage::Read);
+            job.input.clear();
+            for (const Segment &segment : *job.segments) {
+                job.input.resize(job.input.size() + segment.length);
+                readRange(sources[segment.source].path, segment.memberOffset, segment.length,
+                          job.input.data() + job.input.size() - segment.length);
+            }
+            return true;
+        },
+        [&options](CreateJob &job) {
+            thread_local Compressor::Scratch scratch;
+            job.block.clear();
+            Compressor::compressBlock(job.input.data(), job.input.size(), options, scratch, job.block);
+            // A block of one segment already carries its CRC in the frame
+            job.crcs.clear();
+            if (job.segments->size() == 1) {
+                job.crcs.push_back(getU32(job.block.data() + 8));
+                return;
+            }
+            PipelineStats::measure(options.stats, Stage::Checksum, [&]() {
+                size_t position = 0;
+                for (const Segment &segment : *job.segments) {
+                    job.crcs.push_back(Crc32c::compute(job.input.data() + position, segment.length));
+                    position += segment.length;
+                }
+            });
+        },
+        [&](CreateJob &job) {
+            const std::vector<Segment> &segments = *job.segments;
+            for (size_t s = 0; s < segments.size(); s++) {
+                Member &member = sources[segments[s].source].member;
+                member.crc = Crc32c::combine(member.crc, job.crcs[s], segments[s].length);
+            }
+            const std::vector<uint8_t> &block = job.block;
+            PipelineStats::Timer timer(options.stats, Stage::Write);
+            out.write(reinterpret_cast<const char *>(block.data()), block.size());
+            if (!out) throw std::runtime_error("Failed writing compressed block");
+            index.push_back({offset, static_cast<uint32_t>(block.size()), getU32(block.data()), getU32(block.data() + 8)});
+            offset += block.size();
+        },
+        options.threads);
+
+    // Block index and .rsk footer, then the member index and the archive footer
+    std::vector<uint8_t> trailer;
+    Compressor::putBlockIndex(trailer, index, offset);
+    uint64_t memberIndexOffset = offset + trailer.size();
+    size_t memberIndexStart = trailer.size();
+    uint64_t inputSize = 0;
+    putU32(trailer, static_cast<uint32_t>(sources.size()));
+    for (const Source &source : sources) {
+        const Member &member = source.member;
+        putU16(trailer, static_cast<uint16_t>(member.name.size()));
+        trailer.insert(trailer.end(), member.name.begin(), member.name.end());
+        putU64(trailer, member.offset);
+        putU64(trailer, member.size);
+        putU32(trailer, member.crc);
+        inputSize += member.size;
+    }
+    uint32_t memberIndexCrc = Crc32c::compute(trailer.data() + memberIndexStart, trailer.size() - memberIndexStart);
+    putU64(trailer, memberIndexOffset);
+    putU32(trailer, memberIndexCrc);
+    trailer.insert(trailer.end(), RSK_ARCHIVE_INDEX_MAGIC, RSK_ARCHIVE_INDEX_MAGIC + 4);
+
+    PipelineStats::measure(options.stats, Stage::Write, [&]() {
+        out.write(reinterpret_cast<const char *>(trailer.data()), trailer.size());
+        out.flush();
+    });
+    if (!out) throw std::runtime_error("Failed writing archive index");
+    return std::make_pair(static_cast<size_t>(inputSize), static_cast<size_t>(offset + trailer.size()));
+}
+
+// Check the header, both indexes and the footers of a mapped archive
+// Members must tile the data held by the blocks in order, which keeps every slice in bounds
+void Archive::readMemberIndex(
+    const uint8_t *file,
+    uint64_t fileSize,
+    uint32_t &blockSize,
+    std::vector<BlockIndexEntry> &index,
+    std::vector<Member> &members
+) {
+    if (fileSize < RSK_FILE_HEADER_SIZE + RSK_ARCHIVE_FOOTER_SIZE ||
+        std::string(reinterpret_cast<const char *>(file), 3) != RSK_ARCHIVE_MAGIC)
+        throw std::runtime_error("not an .rsa archive");
+    if (file[3] != RSK_VERSION)
+        throw std::runtime_error("Unsupported archive version " + std::to_string(file[3]) +
+                                 " (expected " + std::to_string(RSK_VERSION) + ")");
+    blockSize = getU32(file + 4);
+    if (blockSize < MIN_BLOCK_SIZE || blockSize > MAX_BLOCK_SIZE || getU32(file + 8) != 0)
+        throw std::runtime_error("Corrupt header: invalid archive header");
+
+    const uint8_t *footer = file + fileSize - RSK_ARCHIVE_FOOTER_SIZE;
+    if (std::string(reinterpret_cast<const char *>(footer) + 12, 4) != RSK_ARCHIVE_INDEX_MAGIC)
+        throw std::runtime_error("Corrupt trailer: member index footer not found");
+    uint64_t memberIndexOffset = getU64(footer);
+    if (memberIndexOffset < RSK_FILE_HEADER_SIZE + 8 + RSK_FOOTER_SIZE ||
+        memberIndexOffset > fileSize - RSK_ARCHIVE_FOOTER_SIZE - 4)
+        throw std::runtime_error("Corrupt trailer: member index offset out of bounds");
+    const uint8_t *p = file + memberIndexOffset;
+    if (Crc32c::compute(p, footer - p) != getU32(footer + 8))
+        throw std::runtime_error("Corrupt trailer: member index CRC32C mismatch");
+
+    Decompressor::readBlockIndex(file, memberIndexOffset, RSK_FILE_HEADER_SIZE, blockSize, index);
+    uint64_t dataSize = 0;
+    for (const BlockIndexEntry &entry : index) dataSize += entry.originalSize;
+
+    uint32_t count = getU32(p);
+    p += 4;
+    members.clear();
+    members.reserve(std::min<uint64_t>(count, (footer - p) / 22));
+    uint64_t expectedOffset = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        if (footer - p < 2) throw std::runtime_error("Corrupt trailer: member index truncated");
+        size_t nameLength = getU16(p);
+        p += 2;
+        if (static_cast<size_t>(footer - p) < nameLength + 20) throw std::runtime_error("Corrupt trailer: member index truncated");
+        Member member;
+        member.name.assign(reinterpret_cast<const char *>(p), nameLength);
+        p += nameLength;
+        member.offset = getU64(p);
+        member.size = getU64(p + 8);
+        member.crc = getU32(p + 16);
+        p += 20;
+        if (!isSafeName(member.name)) throw std::runtime_error("Corrupt trailer: unsafe member name " + member.name);
+        if (member.offset != expectedOffset || member.size > dataSize - member.offset)
+            throw std::runtime_error("Corrupt trailer: member " + member.name + " lies outside the archived data");
+        expectedOffset += member.size;
+        members.push_back(std::move(member));
+    }
+    if (p != footer || expectedOffset != dataSize)
+        throw std::runtime_error("Corrupt trailer: member index does not cover the archived data");
+}
+
+std::vector<Archive::Member> Archive::List(const std::string &archiveFile) {
+    MappedFile in(archiveFile);
+    uint32_t blockSize;
+    std::vector<BlockIndexEntry> index;
+    std::vector<Member> members;
+    try {
+        Archive::readMemberIndex(in.data(), in.size(), blockSize, index, members);
+    }
+    catch(const std::exception &e) {
+        throw std::runtime_error("Failed while reading " + archiveFile + ": " + e.what());
+    }
+    return members;
+}
+
+std::pair<size_t, size_t> Archive::Extract(const std::string &archiveFile, const std::vector<std::string> &names,
+                                           const std::string &outputDir, size_t threads, PipelineStats *stats) {
+    MappedFile in(archiveFile);
+    uint32_t blockSize;
+    std::vector<BlockIndexEntry> index;
+    std::vector<Member> members;
+    PipelineStats::measure(stats, Stage::Read, [&]() {
+        try {
+            Archive::readMemberIndex(in.data(), in.size(), blockSize, index, members);
+        }
+        catch(const std::exception &e) {
+            throw std::runtime_error("Failed while reading " + archiveFile + ": " + e.what());
+        }
+    });
+
+    // Selected members in archive order
+    std::vector<const Member *> selected;
+    if (names.empty()) {
+        for (const Member &member : members) selected.push_back(&member);
+    } else {
+        std::unordered_map<std::string, const Member *> byName;
+        for (const Member &member : members) byName[member.name] = &member;
+        for (const std::string &name : names) {
+            auto found = byName.find(memberName(name));
+            if (found == byName.end()) throw std::runtime_error("No member named " + name + " in " + archiveFile);
+            selected.push_back(found->second);
+        }
+        std::sort(selected.begin(), selected.end(), [](const Member *a, const Member *b) { return a->offset < b->offset; });
+        selected.erase(std::unique(selected.begin(), selected.end()), selected.end());
+    }
+
+    // Blocks the selected members lie in, blockStart[b] being where block b starts in the member data
+    std::vector<uint64_t> blockStart(index.size() + 1, 0);
+    for (size_t b = 0; b < index.size(); b++) blockStart[b + 1] = blockStart[b] + index[b].originalSize;
+    std::vector<size_t> needed;
+    for (const Member *member : selected) {
+        if (member->size == 0) continue;
+        size_t first = std::upper_bound(blockStart.begin(), blockStart.end(), member->offset) - blockStart.begin() - 1;
+        size_t last = std::upper_bound(blockStart.begin(), blockStart.end(), member->offset + member->size - 1) - blockStart.begin() - 1;
+        for (size_t b = std::max(first, needed.empty() ? first : needed.back() + 1); b <= last; b++) needed.push_back(b);
+    }
+
+    // Directories and empty members are created up front, the rest as their first block arrives
+    std::string lastDirectory;
+    auto openMember = [&](const Member &member, std::ofstream &file) {
+        std::string path = outputDir + "/" + member.name;
+        std::string directory = path.substr(0, path.rfind('/'));
+        if (directory != lastDirectory) {
+            makeDirectories(directory);
+            lastDirectory = directory;
+        }
+        file.open(path, std::ios::binary | std::ios::trunc);
+        if (!file) throw std::runtime_error("Failed to create " + path);
+    };
+    for (const Member *member : selected) {
+        if (member->size > 0) continue;
+        std::ofstream file;
+        openMember(*member, file);
+    }
+
+    size_t nextMember = 0;
+    std::ofstream file;
+    uint32_t crc = 0;
+    uint64_t extracted = 0;
+    auto consume = [&](size_t b, const std::vector<uint8_t> &data) {
+        uint64_t start = blockStart[b], end = blockStart[b + 1];
+        while (nextMember < selected.size()) {
+            const Member &member = *selected[nextMember];
+            if (member.size == 0) {
+                nextMember++;
+                continue;
+            }
+            if (member.offset >= end) break;
+            uint64_t from = std::max(member.offset, start), to = std::min(member.offset + member.size, end);
+            if (from == member.offset) {
+                openMember(member, file);
+                crc = 0;
+            }
+            const uint8_t *slice = data.data() + (from - start);
+            PipelineStats::measure(stats, Stage::Checksum, [&]() { crc = Crc32c::update(crc, slice, to - from); });
+            PipelineStats::measure(stats, Stage::Write, [&]() {
+                file.write(reinterpret_cast<const char *>(slice), to - from);
+            });
+            if (!file) throw std::runtime_error("Failed writing " + member.name);
+            extracted += to - from;
+            if (to < member.offset + member.size) break;
+            file.close();
+            if (crc != member.crc) throw std::runtime_error("Corrupt archive: CRC32C mismatch in member " + member.name);
+            nextMember++;
+        }
+    };
+
+    // Blocks are read from the mapping, so the reader only picks the next one; the workers decode
+    // them and this thread writes the members
+    size_t nextNeeded = 0;
+    BlockPipeline<ExtractJob>::run(
+        [&](ExtractJob &job) {
+            if (nextNeeded == needed.size()) return false;
+            job.block = needed[nextNeeded++];
+            return true;
+        },
+        [&in, &index, stats](ExtractJob &job) {
+            thread_local Decompressor::Scratch scratch;
+            const BlockIndexEntry &entry = index[job.block];
+            job.decoded.resize(entry.originalSize);
+            Decompressor::decompressBlock(Decompressor::locateBlock(in.data(), entry),
+                                          entry.compressedSize - BLOCK_FRAME_HEADER_SIZE, entry.originalSize,
+                                          entry.crc, job.decoded.data(), scratch, stats);
+        },
+        [&](ExtractJob &job) { consume(job.block, job.decoded); },
+        threads);
+
+    return std::make_pair(static_cast<size_t>(in.size()), static_cast<size_t>(extracted));
+}
@@ -0,0 +1,70 @@
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+#include "compressor.h"
+
+class PipelineStats;
+
+// Multi-file .rsa archives
+// Members are packed back to back into blocks, so small files share blocks instead of paying for a
+// container each. Blocks are compressed on the worker pool and a central member index at the end
+// lets a single member be extracted by decoding only the blocks it lies in
+class Archive {
+public:
+    // Entry of the member index
+    struct Member {
+        std::string name;  // Relative path with '/' separators
+        uint64_t offset;   // Start of the member within the member data held by the blocks
+        uint64_t size;
+        uint32_t crc;      // CRC32C of the member's bytes
+    };
+
+private:
+    // A file going into the archive and the member it becomes
+    struct Source {
+        std::string path;
+        Member member;
+    };
+
+    // Part of one member inside a block
+    struct Segment {
+        size_t source;
+        uint64_t memberOffset;
+        size_t length;
+    };
+
+    // Blocks on their way through the create and extract pipelines
+    struct CreateJob;
+    struct ExtractJob;
+
+    static void addInput(const std::string &path, std::vector<Source> &sources);
+    static void addPath(const std::string &path, const std::string &name, bool followLinks, std::vector<Source> &sources);
+    static std::vector<std::vector<Segment>> planBlocks(std::vector<Source> &sources, size_t blockSize);
+    static void readMemberIndex(
+        const uint8_t *file,
+        uint64_t fileSize,
+        uint32_t &blockSize,
+        std::vector<BlockIndexEntry> &index,
+        std::vector<Member> &members
+    );
+
+public:
+    // inputs are files, directories (added recursively, in name order) or @list files naming one input per line
+    // Only files become members, so directories that hold no files are not archived
+    // Returns the bytes of all members and the archive size
+    static std::pair<size_t, size_t> Create(const std::string &archiveFile, const std::vector<std::string> &inputs,
+                                            const CompressionOptions &options = CompressionOptions());
+
+    static std::vector<Member> List(const std::string &archiveFile);
+
+    // Extracts the named members, or all of them when names is empty, below outputDir
+    // Every member is checked against its CRC32C; returns the archive size and the bytes extracted
+    static std::pair<size_t, size_t> Extract(const std::string &archiveFile, const std::vector<std::string> &names,
+                                             const std::string &outputDir, size_t threads = 0,
+                                             PipelineStats *stats = nullptr);
+};
+
+#endif // ARCHIVE_H
@@ -0,0 +1,382 @@
+// Per-stage benchmark of the block pipeline over generated corpora
+// use ./rsk_benchmark to run every corpus at the default block sizes and print CSV
+// use ./rsk_benchmark --format=json > results.json for JSON output
+// use ./rsk_benchmark --corpus=text,logs --sizes=256k,4m --min-time=1 to narrow or lengthen the run
+// use ./rsk_benchmark --levels to time whole-buffer compression and decompression at every level instead
+//
+// Every stage runs on one block of the given size, repeatedly until --min-time seconds have
+// passed, and the fastest run is reported. Throughput is always relative to the original block
+// size, so the stages of one block add up
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <functional>
+#include <stdexcept>
+#include <cstring>
+#include <cmath>
+#include <cstdio>
+#include <cctype>
+#include <ctime>
+#include "compressor.h"
+#include "decompressor.h"
+#include "crc32c.h"
+#include "huffmanTree.h"
+#include "histogram.h"
+#include "zeroRunLength.h"
+#include "rskFormat.h"
+
+// Parses a byte count with an optional k/m suffix, e.g. 900k or 4m
+static size_t parseSize(const std::string &value) {
+    size_t pos = 0;
+    unsigned long long size = std::stoull(value, &pos);
+    std::string suffix = value.substr(pos);
+    if (suffix == "k" || suffix == "K") size *= 1024;
+    else if (suffix == "m" || suffix == "M") size *= 1024 * 1024;
+    else if (!suffix.empty()) throw std::runtime_error("Invalid size: " + value);
+    return static_cast<size_t>(size);
+}
+
+static std::vector<std::string> splitList(const std::string &value) {
+    std::vector<std::string> items;
+    std::stringstream stream(value);
+    std::string item;
+    while (std::getline(stream, item, ',')) if (!item.empty()) items.push_back(item);
+    return items;
+}
+
+// Corpus generators, all deterministic for a given seed
+
+static std::vector<uint8_t> randomBytes(size_t n, std::mt19937_64 &rng) {
+    std::vector<uint8_t> data(n);
+    for (uint8_t &byte : data) byte = static_cast<uint8_t>(rng());
+    return data;
+}
+
+static std::vector<uint8_t> zeroBytes(size_t n, std::mt19937_64 &) {
+    return std::vector<uint8_t>(n, 0);
+}
+
+// Pseudo words built from syllables, drawn with Zipf frequencies like natural language
+class WordSource {
+    std::vector<std::string> words;
+    std::vector<double> cumulative;
+
+public:
+    explicit WordSource(std::mt19937_64 &rng, size_t vocabulary = 4000) {
+        static const char *syllables[] = {"th", "e", "an", "re", "in", "on", "er", "at", "ou", "st", "ing", "ed",
+                                          "al", "is", "or", "ti", "en", "it", "ar", "le", "co", "pro", "ment", "ly"};
+        const size_t syllableCount = sizeof(syllables) / sizeof(syllables[0]);
+        double total = 0;
+        for (size_t rank = 1; rank <= vocabulary; rank++) {
+            std::string word;
+            size_t length = 1 + rng() % 3;
+            for (size_t i = 0; i < length; i++) word += syllables[rng() % syllableCount];
+            words.push_back(word);
+            total += 1.0 / rank;
+            cumulative.push_back(total);
+        }
+    }
+
+    const std::string &next(std::mt19937_64 &rng) {
+        double x = std::uniform_real_distribution<double>(0, cumulative.back())(rng);
+        return words[std::lower_bound(cumulative.begin(), cumulative.end(), x) - cumulative.begin()];
+    }
+};
+
+static std::vector<uint8_t> englishText(size_t n, std::mt19937_64 &rng) {
+    WordSource words(rng);
+    std::string text;
+    text.reserve(n + 256);
+    while (text.size() < n) {
+        size_t sentence = 5 + rng() % 16;
+        for (size_t i = 0; i < sentence; i++) {
+            std::string word = words.next(rng);
+            if (i == 0) word[0] = static_cast<char>(std::toupper(word[0]));
+            text += word;
+            text += (i + 1 == sentence) ? (rng() % 8 == 0 ? "?" : ".") : (rng() % 10 == 0 ? ", " : " ");
+        }
+        text += (rng() % 6 == 0) ? "\n\n" : " ";
+    }
+    text.resize(n);
+    return std::vector<uint8_t>(text.begin(), text.end());
+}
+
+static std::vector<uint8_t> logLines(size_t n, std::mt19937_64 &rng) {
+    static const char *levels[] = {"INFO", "INFO", "INFO", "DEBUG", "WARN", "ERROR"};
+    static const char *paths[] = {"/api/v1/users", "/api/v1/orders", "/api/v1/items", "/health", "/login"};
+    static const int statuses[] = {200, 200, 200, 201, 304, 404, 500};
+    std::string text;
+    text.reserve(n + 256);
+    uint64_t millis = 1700000000000ULL;
+    char line[256];
+    while (text.size() < n) {
+        millis += rng() % 50;
+        time_t seconds = static_cast<time_t>(millis / 1000);
+        struct tm utc;
+        gmtime_r(&seconds, &utc);
+        int length = std::snprintf(line, sizeof(line),
+            "%04d-%02d-%02dT%02d:%02d:%02d.%03dZ %s [worker-%d] request id=%08llx path=%s/%u status=%d latency_ms=%u\n",
+            utc.tm_year + 1900, utc.tm_mon + 1, utc.tm_mday, utc.tm_hour, utc.tm_min, utc.tm_sec,
+            static_cast<int>(millis % 1000), levels[rng() % 6], static_cast<int>(rng() % 8),
+            static_cast<unsigned long long>(rng() & 0xffffffff), paths[rng() % 5],
+            static_cast<unsigned>(rng() % 10000), statuses[rng() % 7], static_cast<unsigned>(rng() % 300));
+        text.append(line, length);
+    }
+    text.resize(n);
+    return std::vector<uint8_t>(text.begin(), text.end());
+}
+
+static std::vector<uint8_t> jsonRecords(size_t n, std::mt19937_64 &rng) {
+    WordSource words(rng, 500);
+    std::string text;
+    text.reserve(n + 512);
+    char number[64];
+    for (uint64_t id = 1; text.size() < n; id++) {
+        std::string first = words.next(rng), last = words.next(rng);
+        std::snprintf(number, sizeof(number), "%.2f", (rng() % 100000) / 100.0);
+        text += "{\"id\":" + std::to_string(id) + ",\"name\":\"" + first + " " + last + "\",\"email\":\"" +
+                first + "." + last + "@example.com\",\"active\":" + (rng() % 3 ? "true" : "false") +
+                ",\"score\":" + number + ",\"tags\":[\"" + words.next(rng) + "\",\"" + words.next(rng) + "\"]}\n";
+    }
+    text.resize(n);
+    return std::vector<uint8_t>(text.begin(), text.end());
+}
+
+struct Corpus {
+    const char *name;
+    std::vector<uint8_t> (*generate)(size_t, std::mt19937_64 &);
+};
+
+static const Corpus corpora[] = {
+    {"random", randomBytes},
+    {"text", englishText},
+    {"logs", logLines},
+    {"zeros", zeroBytes},
+    {"json", jsonRecords},
+};
+
+struct Result {
+    std::string corpus;
+    size_t size;
+    std::string side;
+    std::string stage;
+    size_t runs;
+    double seconds;        // Fastest run
+    size_t outputBytes;    // Compressed size, only reported for whole blocks
+};
+
+// Runs stage until minSeconds have passed (at least once) and returns the fastest run
+static double measure(const std::function<void()> &stage, double minSeconds, size_t &runs) {
+    using Clock = std::chrono::steady_clock;
+    double best = INFINITY, total = 0;
+    runs = 0;
+    do {
+        Clock::time_point start = Clock::now();
+        stage();
+        double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        best = std::min(best, seconds);
+        total += seconds;
+        runs++;
+    } while (total < minSeconds);
+    return best;
+}
+
+// Times every compression and decompression stage on one block
+static void benchmarkBlock(const std::string &corpus, const std::vector<uint8_t> &data, double minSeconds,
+                           std::vector<Result> &results) {
+    CompressionOptions options;
+    size_t n = data.size();
+
+    // Intermediate results of every stage feed the next one
+    std::pair<std::string, size_t> bwt;
+    std::vector<int32_t> suffixArray;
+    std::vector<size_t> bwtCursors;
+    std::vector<uint8_t> mtf;
+    std::vector<uint16_t> symbols;
+    std::vector<size_t> counts;
+    std::vector<uint8_t> selectors;
+    std::vector<std::vector<uint8_t>> codeLengths;
+    std::vector<std::vector<uint16_t>> frequencies;
+    std::vector<uint8_t> block;
+    std::vector<uint8_t> ransBlock;
+
+    auto record = [&](const char *side, const char *stage, const std::function<void()> &run) {
+        size_t runs;
+        double seconds = measure(run, minSeconds, runs);
+        results.push_back({corpus, n, side, stage, runs, seconds, 0});
+    };
+
+    record("compress", "bwt", [&]() {
+        bwt.second = Compressor::BWTEncoding(data.data(), n, options.engine, suffixArray, bwt.first, bwtCursors);
+    });
+    record("compress", "mtf", [&]() { mtf = Compressor::MTFEncoding(bwt.first); });
+    record("compress", "zero_runs", [&]() { symbols = ZeroRunLength::encode(mtf.data(), mtf.size()); });
+    record("compress", "histogram", [&]() {
+        counts.resize(ZeroRunLength::ALPHABET_SIZE);
+        Histogram::countSymbols(symbols.data(), symbols.size(), counts.size(), counts.data());
+    });
+    record("compress", "huffman_build", [&]() {
+        codeLengths = huffmanTree::buildGroupedCodeLengths(symbols, counts, MAX_CODE_LENGTH, options.huffmanTables, options.refinePasses, selectors);
+    });
+    record("compress", "huffman_encode", [&]() {
+        block.clear();
+        Compressor::encodeBlock(symbols, n, Crc32c::compute(data.data(), n), BLOCK_FLAG_ZERO_RUNS, codeLengths, {}, selectors, bwtCursors, block);
+    });
+    record("compress", "rans_build", [&]() {
+        Compressor::chooseRans(symbols, counts, codeLengths, selectors, frequencies);
+    });
+    record("compress", "rans_encode", [&]() {
+        ransBlock.clear();
+        Compressor::encodeBlock(symbols, n, 0, BLOCK_FLAG_ZERO_RUNS | BLOCK_FLAG_RANS, codeLengths, frequencies, selectors,
+                                bwtCursors, ransBlock);
+    });
+    std::vector<uint8_t> compressed;
+    record("compress", "block", [&]() { compressed = Compressor::compressBlock(data.data(), n, options); });
+    results.back().outputBytes = compressed.size();
+
+    // The whole block may have picked rANS, the Huffman stages time the Huffman coded block
+    const uint8_t *body = block.data() + BLOCK_FRAME_HEADER_SIZE;
+    size_t bodySize = block.size() - BLOCK_FRAME_HEADER_SIZE;
+    Decompressor::BlockHeader header;
+    std::vector<uint16_t> decodedSymbols;
+    std::vector<uint8_t> decodedMTF(n);
+    std::string lastColumn;
+    std::vector<uint32_t> links;
+    std::vector<uint8_t> output(n);
+
+    record("decompress", "huffman_decode", [&]() {
+        Decompressor::readBlockForDecompression(body, bodySize, static_cast<uint32_t>(n), header);
+        decodedSymbols.resize(header.codedSymbols);
+        Decompressor::decodeSymbols(body, bodySize, header, decodedSymbols.data());
+    });
+    std::vector<uint16_t> ransSymbols;
+    record("decompress", "rans_decode", [&]() {
+        Decompressor::BlockHeader ransHeader;
+        const uint8_t *ransBody = ransBlock.data() + BLOCK_FRAME_HEADER_SIZE;
+        Decompressor::readBlockForDecompression(ransBody, ransBlock.size() - BLOCK_FRAME_HEADER_SIZE, static_cast<uint32_t>(n), ransHeader);
+        ransSymbols.resize(ransHeader.codedSymbols);
+        Decompressor::decodeSymbols(ransBody, ransBlock.size() - BLOCK_FRAME_HEADER_SIZE, ransHeader, ransSymbols.data());
+    });
+    if (ransSymbols != symbols) throw std::runtime_error("rANS round trip failed for " + corpus);
+    record("decompress", "zero_runs", [&]() {
+        ZeroRunLength::decode(decodedSymbols.data(), decodedSymbols.size(), decodedMTF.data(), n);
+    });
+    record("decompress", "mtf", [&]() { lastColumn = Decompressor::MTFDecoding(decodedMTF); });
+    record("decompress", "inverse_bwt", [&]() {
+        Decompressor::inverseBWT(reinterpret_cast<const uint8_t *>(lastColumn.data()), n, header.bwtCursors, output.data(), links);
+    });
+    if (output != data) throw std::runtime_error("Stage round trip failed for " + corpus);
+    record("decompress", "block", [&]() {
+        Decompressor::decompressBlock(compressed.data() + BLOCK_FRAME_HEADER_SIZE, compressed.size() - BLOCK_FRAME_HEADER_SIZE,
+                                      static_cast<uint32_t>(n), getU32(compressed.data() + 8), output.data());
+    });
+    if (output != data) throw std::runtime_error("Block round trip failed for " + corpus);
+}
+
+// Times compression and decompression of a whole buffer on one thread at every level
+// Sizes are input sizes here, so a buffer spans several blocks at the levels with small ones
+static void benchmarkLevels(const std::string &corpus, const std::vector<uint8_t> &data, double minSeconds,
+                            std::vector<Result> &results) {
+    Compressor::Scratch compressScratch;
+    Decompressor::Scratch decompressScratch;
+    std::vector<uint8_t> packed, unpacked;
+    for (int level = MIN_COMPRESSION_LEVEL; level <= MAX_COMPRESSION_LEVEL; level++) {
+        CompressionOptions options = CompressionOptions::forLevel(level);
+        std::string stage = "level" + std::to_string(level);
+        Result compress = {corpus, data.size(), "compress", stage, 0, 0, 0};
+        compress.seconds = measure([&]() {
+            Compressor::CompressBuffer(data.data(), data.size(), options, compressScratch, packed);
+        }, minSeconds, compress.runs);
+        compress.outputBytes = packed.size();
+        results.push_back(compress);
+
+        Result decompress = {corpus, data.size(), "decompress", stage, 0, 0, packed.size()};
+        decompress.seconds = measure([&]() {
+            Decompressor::DecompressBuffer(packed.data(), packed.size(), decompressScratch, unpacked);
+        }, minSeconds, decompress.runs);
+        results.push_back(decompress);
+        if (unpacked != data) throw std::runtime_error("Level " + std::to_string(level) + " round trip failed for " + corpus);
+    }
+}
+
+static void printCSV(const std::vector<Result> &results) {
+    std::printf("corpus,size,side,stage,runs,seconds,mb_per_s,ns_per_byte,output_bytes\n");
+    for (const Result &r : results)
+        std::printf("%s,%zu,%s,%s,%zu,%.6f,%.2f,%.3f,%zu\n", r.corpus.c_str(), r.size, r.side.c_str(), r.stage.c_str(),
+                    r.runs, r.seconds, r.size / r.seconds / 1e6, r.seconds * 1e9 / r.size, r.outputBytes);
+}
+
+static void printJSON(const std::vector<Result> &results) {
+    std::printf("[\n");
+    for (size_t i = 0; i < results.size(); i++) {
+        const Result &r = results[i];
+        std::printf("  {\"corpus\": \"%s\", \"size\": %zu, \"side\": \"%s\", \"stage\": \"%s\", \"runs\": %zu, "
+                    "\"seconds\": %.6f, \"mb_per_s\": %.2f, \"ns_per_byte\": %.3f, \"output_bytes\": %zu}%s\n",
+                    r.corpus.c_str(), r.size, r.side.c_str(), r.stage.c_str(), r.runs, r.seconds,
+                    r.size / r.seconds / 1e6, r.seconds * 1e9 / r.size, r.outputBytes, i + 1 < results.size() ? "," : "");
+    }
+    std::printf("]\n");
+}
+
+int main(int argc, char *argv[]) {
+    try {
+        std::vector<std::string> corpusNames;
+        for (const Corpus &corpus : corpora) corpusNames.push_back(corpus.name);
+        std::vector<size_t> sizes = {MIN_BLOCK_SIZE, DEFAULT_BLOCK_SIZE, MAX_BLOCK_SIZE};
+        std::string format = "csv";
+        double minSeconds = 0.3;
+        uint64_t seed = 1;
+        bool levels = false;
+        bool sizesGiven = false;
+
+        for (int i = 1; i < argc; i++) {
+            std::string opt = argv[i];
+            if (opt.rfind("--corpus=", 0) == 0) corpusNames = splitList(opt.substr(9));
+            else if (opt.rfind("--sizes=", 0) == 0) {
+                sizesGiven = true;
+                sizes.clear();
+                for (const std::string &size : splitList(opt.substr(8))) sizes.push_back(parseSize(size));
+            }
+            else if (opt.rfind("--format=", 0) == 0) format = opt.substr(9);
+            else if (opt.rfind("--min-time=", 0) == 0) minSeconds = std::stod(opt.substr(11));
+            else if (opt.rfind("--seed=", 0) == 0) seed = std::stoull(opt.substr(7));
+            else if (opt == "--levels") levels = true;
+            else {
+                std::cerr << "Usage: " << argv[0] << " [--corpus=random,text,logs,zeros,json] [--sizes=N[k|m],...]"
+                          << " [--format=csv|json] [--min-time=SECONDS] [--seed=N] [--levels]" << std::endl;
+                return 1;
+            }
+        }
+        if (format != "csv" && format != "json") throw std::runtime_error("Unknown format: " + format);
+        if (levels && !sizesGiven) sizes = {MAX_BLOCK_SIZE};
+
+        std::vector<Result> results;
+        for (const std::string &name : corpusNames) {
+            const Corpus *corpus = std::find_if(std::begin(corpora), std::end(corpora),
+                                                [&](const Corpus &c) { return name == c.name; });
+            if (corpus == std::end(corpora)) throw std::runtime_error("Unknown corpus: " + name);
+            for (size_t size : sizes) {
+                if (size == 0 || (!levels && size > MAX_BLOCK_SIZE))
+                    throw std::runtime_error("Sizes must be between 1 byte and the maximum block size");
+                std::mt19937_64 rng(seed);
+                std::vector<uint8_t> data = corpus->generate(size, rng);
+                std::cerr << "Benchmarking " << name << " at " << size << " bytes" << std::endl;
+                if (levels) benchmarkLevels(name, data, minSeconds, results);
+                else benchmarkBlock(name, data, minSeconds, results);
+            }
+        }
+
+        if (format == "json") printJSON(results);
+        else printCSV(results);
+    }
+    catch (const std::exception &e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,60 @@
+#ifndef BIT_WRITER_H
+#define BIT_WRITER_H
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Packs variable length codes MSB-first into a byte buffer
+// Codes collect in a 64-bit accumulator that is stored one whole big endian word at a time
+class BitWriter {
+    std::vector<uint8_t> &out;
+    size_t start;       // Where this writer's bytes begin in out
+    size_t pos;         // Next byte to store
+    uint64_t acc = 0;   // Pending bits, right aligned
+    int bits = 0;       // Number of pending bits, always below 64
+
+    void storeWord(uint64_t word) {
+        if (pos + 8 > out.size()) out.resize(out.size() + std::max<size_t>(out.size() / 2, 4096));
+        uint8_t *dst = out.data() + pos;
+        for (int i = 0; i < 8; i++) dst[i] = static_cast<uint8_t>(word >> (56 - 8 * i));
+        pos += 8;
+    }
+
+public:
+    // Appends to out, sizeHint is the number of bytes expected to be written
+    explicit BitWriter(std::vector<uint8_t> &out, size_t sizeHint = 0)
+        : out(out), start(out.size()), pos(out.size()) {
+        out.resize(pos + sizeHint + 8);
+    }
+
+    // Appends the low length bits of code, length is at most 32
+    void write(uint32_t code, int length) {
+        int spill = bits + length - 64;
+        if (spill < 0) {
+            acc = (acc << length) | code;
+            bits += length;
+            return;
+        }
+        // Fill the word with the high bits of the code and keep the rest pending
+        storeWord((acc << (length - spill)) | (static_cast<uint64_t>(code) >> spill));
+        acc = code & ((uint64_t(1) << spill) - 1);
+        bits = spill;
+    }
+
+    // Stores the pending bits, zero padded to a whole byte, and trims out to the written size
+    // Returns the number of bits written, padding excluded
+    uint64_t finish() {
+        uint64_t totalBits = static_cast<uint64_t>(pos - start) * 8 + bits;
+        int bytes = (bits + 7) / 8;
+        uint64_t aligned = acc << (bytes * 8 - bits);
+        out.resize(pos + bytes);
+        for (int i = 0; i < bytes; i++) out[pos + i] = static_cast<uint8_t>(aligned >> (8 * (bytes - 1 - i)));
+        pos += bytes;
+        acc = 0;
+        bits = 0;
+        return totalBits;
+    }
+};
+
+#endif // BIT_WRITER_H
@@ -0,0 +1,117 @@
+#ifndef BLOCK_PIPELINE_H
+#define BLOCK_PIPELINE_H
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "threadPool.h"
+
+// FIFO of at most capacity items shared between threads
+// push blocks while the queue is full and pop while it is empty; after close both return false
+// at once, except that pop still hands out the items already queued
+template <typename T>
+class BoundedQueue {
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<T> items;
+    size_t capacity;
+    bool closed = false;
+
+public:
+    explicit BoundedQueue(size_t capacity) : capacity(capacity) {}
+
+    bool push(T item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [this] { return closed || items.size() < capacity; });
+        if (closed) return false;
+        items.push_back(std::move(item));
+        changed.notify_all();
+        return true;
+    }
+
+    bool pop(T &item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [this] { return closed || !items.empty(); });
+        if (items.empty()) return false;
+        item = std::move(items.front());
+        items.pop_front();
+        changed.notify_all();
+        return true;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        changed.notify_all();
+    }
+};
+
+// Reader, workers and writer of a block stream, running at the same time
+// A reader thread fills jobs taken from a pool of recycled ones, the workers of a ThreadPool transform
+// them and the calling thread writes them in reading order before handing them back to the pool
+// The pool holds two jobs per worker plus one being read and one being written, so a stage that falls
+// behind stalls the others instead of letting buffers pile up, and the run takes about as long as its
+// slowest stage
+// Jobs keep their input and output buffers between blocks, so those are sized once per run
+template <typename Job>
+class BlockPipeline {
+public:
+    // read returns false at the end of the input; the first exception of any stage ends the run and
+    // is rethrown once every job in flight has finished
+    static void run(const std::function<bool(Job &)> &read, const std::function<void(Job &)> &work,
+                    const std::function<void(Job &)> &write, size_t threads) {
+        struct Pending {
+            Job *job;
+            std::future<void> done;
+        };
+
+        // Declared ahead of the pool, whose destructor finishes the tasks still holding jobs
+        size_t workers = std::max<size_t>(threads ? threads : ThreadPool::defaultThreadCount(), 1);
+        size_t depth = 2 * workers + 2;
+        std::vector<Job> jobs(depth);
+        BoundedQueue<Job *> free(depth);
+        BoundedQueue<Pending> ordered(depth);
+        ThreadPool pool(workers);
+        for (Job &job : jobs) free.push(&job);
+
+        std::exception_ptr readError;
+        std::thread reader([&]() {
+            try {
+                Job *job;
+                while (free.pop(job) && read(*job)) {
+                    if (!ordered.push({job, pool.submit([&work, job]() { work(*job); })})) break;
+                }
+            }
+            catch (...) {
+                readError = std::current_exception();
+            }
+            ordered.close();
+        });
+
+        Pending pending;
+        try {
+            while (ordered.pop(pending)) {
+                pending.done.get();
+                write(*pending.job);
+                free.push(pending.job);
+            }
+        }
+        catch (...) {
+            free.close();
+            ordered.close();
+            reader.join();
+            throw;
+        }
+        reader.join();
+        if (readError) std::rethrow_exception(readError);
+    }
+};
+
+#endif // BLOCK_PIPELINE_H
@@ -0,0 +1,72 @@
+#include "blockSampler.h"
+#include "histogram.h"
+#include <algorithm>
+#include <cstring>
+
+const size_t BlockSampler::MIN_TRIAL_SIZE;
+const size_t BlockSampler::TRIAL_SIZE;
+
+// 16 windows of 4 KB: 64 KB of a 1 MB block
+static const size_t SAMPLE_WINDOWS = 16;
+static const size_t WINDOW_SIZE = 4096;
+static const int HASH_BITS = 12;
+
+// From this share of repeats on the BWT wins without asking
+static const double FULL_REPEAT_RATIO = 0.05;
+// The trial has to beat the order-0 entropy by this many bits per byte to be worth the BWT
+static const double TRIAL_MARGIN = 0.2;
+// Above this entropy Huffman saves under 2 percent, less than its tables cost on small blocks
+static const double MAX_HUFFMAN_ENTROPY = 7.85;
+
+static inline uint32_t load32(const uint8_t *p) {
+    uint32_t value;
+    std::memcpy(&value, p, 4);
+    return value;
+}
+
+BlockSampler::Estimate BlockSampler::estimate(const uint8_t *data, size_t size) {
+    size_t windows = SAMPLE_WINDOWS;
+    size_t windowSize = WINDOW_SIZE;
+    if (size <= windows * windowSize) {
+        windows = 1;
+        windowSize = size;
+    }
+
+    // Last sampled position + 1 of every 4-byte hash, 0 when empty
+    uint32_t seen[1 << HASH_BITS] = {};
+    size_t histogram[256] = {};
+    size_t positions = 0;
+    size_t repeats = 0;
+    for (size_t w = 0; w < windows; w++) {
+        size_t start = (windows == 1) ? 0 : w * (size - windowSize) / (windows - 1);
+        const uint8_t *window = data + start;
+        Histogram::countBytes(window, windowSize, histogram);
+        for (size_t i = 0; i + 4 <= windowSize; i++) {
+            uint32_t bytes = load32(window + i);
+            uint32_t hash = (bytes * 2654435761u) >> (32 - HASH_BITS);
+            uint32_t previous = seen[hash];
+            if (previous && load32(data + previous - 1) == bytes) repeats++;
+            seen[hash] = static_cast<uint32_t>(start + i + 1);
+            positions++;
+        }
+    }
+
+    Estimate estimate = {0, 0};
+    estimate.entropy = Histogram::entropy(histogram, 256);
+    if (positions) estimate.repeatRatio = static_cast<double>(repeats) / positions;
+    return estimate;
+}
+
+BlockMode BlockSampler::choose(const uint8_t *data, size_t size, const Trial &trial) {
+    Estimate estimate = BlockSampler::estimate(data, size);
+    if (!trial) return estimate.entropy > MAX_HUFFMAN_ENTROPY ? BlockMode::Stored : BlockMode::HuffmanOnly;
+    if (estimate.repeatRatio >= FULL_REPEAT_RATIO) return BlockMode::Full;
+    // Without repeats, bytes this close to random leave nothing for the trial to find
+    if (estimate.entropy > MAX_HUFFMAN_ENTROPY) return BlockMode::Stored;
+
+    // Few repeats, but the BWT also gains on data with short contexts, such as sampled signals
+    size_t trialSize = std::min(size, std::max(MIN_TRIAL_SIZE, std::min(size / 16, TRIAL_SIZE)));
+    double trialBits = trial(data + (size - trialSize) / 2, trialSize);
+    if (trialBits < estimate.entropy - TRIAL_MARGIN) return BlockMode::Full;
+    return BlockMode::HuffmanOnly;
+}
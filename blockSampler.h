@@ -0,0 +1,41 @@
+#ifndef BLOCK_SAMPLER_H
+#define BLOCK_SAMPLER_H
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+// How a block is coded, recorded in the block flags
+enum class BlockMode {
+    Full,         // BWT, MTF, zero runs and Huffman
+    HuffmanOnly,  // Huffman codes the original bytes, no BWT or MTF
+    Stored        // Original bytes copied as they are
+};
+
+// Guesses from a sample of a block whether the full pipeline will pay for itself
+// A few evenly spaced windows are read, so the estimate costs a small fraction of the block
+class BlockSampler {
+public:
+    // Bytes handed to the trial when the sample alone does not decide: a sixteenth of the
+    // block, but at least MIN_TRIAL_SIZE and at most TRIAL_SIZE
+    static const size_t MIN_TRIAL_SIZE = 16 * 1024;
+    static const size_t TRIAL_SIZE = 64 * 1024;
+
+    struct Estimate {
+        double entropy;      // Order-0 entropy of the sample in bits per byte
+        double repeatRatio;  // Share of sampled positions whose next 4 bytes were seen before
+    };
+
+    // Codes a slice of the block through the full pipeline and returns its payload bits per byte
+    using Trial = std::function<double(const uint8_t *data, size_t size)>;
+
+    static Estimate estimate(const uint8_t *data, size_t size);
+
+    // Repeated strings are what the BWT exploits, so a block full of them takes the full pipeline
+    // Otherwise a block near 8 bits per byte is stored without a trial, as nothing gains on it; any
+    // other block gets a trial on a slice of it, compared with the order-0 entropy that Huffman alone gains
+    // The slice is the whole block when the block is at most MIN_TRIAL_SIZE
+    // Without a trial the BWT is ruled out and only Huffman only or stored are chosen
+    static BlockMode choose(const uint8_t *data, size_t size, const Trial &trial);
+};
+
+#endif // BLOCK_SAMPLER_H
@@ -1,139 +1,540 @@
 #include "compressor.h"
 #include "huffmanTree.h"
+#include "suffixArray.h"
+#include "blockPipeline.h"
+#include "bitWriter.h"
+#include "mappedFile.h"
+#include "moveToFront.h"
+#include "zeroRunLength.h"
+#include "pipelineStats.h"
+#include "crc32c.h"
+#include "blockSampler.h"
+#include "rans.h"
+#include "histogram.h"
 #include <iostream>
 #include <fstream>
 #include <string>
 #include <ios>
 #include <vector>
-#include <list>
 #include <iostream>
-#include <map>
 #include <unordered_map>
 #include <algorithm>
 #include <utility>
 #include <sys/stat.h>
 #include <stdexcept>
 #include <numeric>
+#include <climits>
+#include <memory>
 #define ALPH_SIZE 256
 
-// Reads the input file for compression
-// Stores the frequency of each occuring character in frequency map
-void Compressor::readInputFileForCompression(
-    const std::string &filename, 
-    std::string &fileContent
+// A block on its way through the compression pipeline
+struct CompressJob {
+    const uint8_t *data;
+    size_t size;
+    std::vector<uint8_t> input;  // Holds the bytes when the reader had to copy them
+    std::vector<uint8_t> block;  // The framed compressed block
+};
+
+// Write the new compressed file
+// The input is mapped and its blocks are compressed straight from the mapping
+void Compressor::writeCompressedFile(
+    const std::string &filename,
+    const CompressionOptions &options,
+    const std::string &outputFile,
+    const std::string &originalExt
 ) {
-    std::ifstream file(filename, std::ios::binary);
-    if (!file.is_open()) throw std::runtime_error("Unable to open " + filename);
+    MappedFile inFile(filename);
 
-    try {
-        // Get file size and reserve space
-        file.seekg(0, std::ios::end);
-        size_t fileSize = file.tellg();
-        file.seekg(0, std::ios::beg);
+    std::ofstream outFile(outputFile, std::ios::binary);
+    outFile.exceptions(std::ofstream::failbit | std::ofstream::badbit);
 
-        fileContent.reserve(fileSize);  // Pre-allocate memory
+    if (!outFile.is_open())
+        throw std::runtime_error("Failed to create output file");
+
+    // Blocks are views into the mapping, which outlives every worker
+    size_t offset = 0;
+    auto nextBlock = [&](const uint8_t *&data, size_t &size, std::vector<uint8_t> &) {
+        if (offset == inFile.size()) return false;
+        data = inFile.data() + offset;
+        size = std::min(options.blockSize, inFile.size() - offset);
+        offset += size;
+        return true;
+    };
 
-        char ch;
-        while (file.get(ch)) {
-            unsigned char uch = static_cast<unsigned char>(ch);
-            fileContent += uch;
-        }
-        if (file.bad()) throw std::runtime_error("I/O error while reading file " + filename);
+    try {
+        Compressor::writeBlocks(nextBlock, outFile, options, originalExt);
+        std::cout << "File has been successfully compressed and saved as "
+             << outputFile << std::endl;
     }
     catch(const std::exception &e) {
         throw std::runtime_error(
-            std::string("Failed while reading input file: ") + e.what()
+            std::string("Failed writing compressed output file: ") + e.what()
         );
     }
 }
 
-// Write the new compressed file
-// Write header data and then write all huffman codes
-void Compressor::writeCompressedFile(
-    const std::vector<uint8_t> &mtfEncoded,
-    const std::map<uint8_t, size_t> &frequencyTable, 
-    const std::unordered_map<uint8_t, std::string> &huffmanCodes, 
-    const std::string &outputFile, 
-    const std::string &originalExt,
-    const size_t lastCol
-) {
-    // Basic validations for header integrity
-    if (frequencyTable.empty()) throw std::runtime_error("Frequency table is empty; nothing to compress");
-    if (frequencyTable.size() > 256) throw std::runtime_error("Frequency table size exceeds alphabet size (256)");
-    if (mtfEncoded.empty()) throw std::runtime_error("MTF-encoded content is empty; invalid input or encoding failure");
-    if (lastCol >= mtfEncoded.size()) throw std::runtime_error("Invalid BWT index; header cannot be written");
+// Block size, BWT, zero runs, Huffman tables and refinement passes of every level
+// The README lists the speed and ratio each level reaches on the benchmark corpora
+static const struct {
+    size_t blockSize;
+    bool useBWT;
+    bool zeroRuns;
+    size_t huffmanTables;
+    int refinePasses;
+} LEVELS[] = {
+    {1024 * 1024, false, false, 1, 1},
+    {1024 * 1024, false, false, 6, 2},
+    {256 * 1024, true, true, 2, 1},
+    {512 * 1024, true, true, 4, 2},
+    {1024 * 1024, true, true, 6, 2},
+    {1024 * 1024, true, true, 6, 4},
+    {2 * 1024 * 1024, true, true, 6, 4},
+    {4 * 1024 * 1024, true, true, 6, 6},
+    {8 * 1024 * 1024, true, true, 6, 8},
+};
+static_assert(sizeof(LEVELS) / sizeof(LEVELS[0]) == MAX_COMPRESSION_LEVEL - MIN_COMPRESSION_LEVEL + 1,
+              "Every compression level needs settings");
+
+CompressionOptions CompressionOptions::forLevel(int level) {
+    if (level < MIN_COMPRESSION_LEVEL || level > MAX_COMPRESSION_LEVEL)
+        throw std::runtime_error("Compression level must be between " + std::to_string(MIN_COMPRESSION_LEVEL) +
+                                 " and " + std::to_string(MAX_COMPRESSION_LEVEL));
+    CompressionOptions options;
+    const auto &settings = LEVELS[level - MIN_COMPRESSION_LEVEL];
+    options.blockSize = settings.blockSize;
+    options.useBWT = settings.useBWT;
+    options.zeroRuns = settings.zeroRuns;
+    options.huffmanTables = settings.huffmanTables;
+    options.refinePasses = settings.refinePasses;
+    return options;
+}
+
+void Compressor::checkOptions(const CompressionOptions &options, const std::string &originalExt) {
+    if (options.blockSize < MIN_BLOCK_SIZE || options.blockSize > MAX_BLOCK_SIZE)
+        throw std::runtime_error("Block size must be between " + std::to_string(MIN_BLOCK_SIZE) +
+                                 " and " + std::to_string(MAX_BLOCK_SIZE) + " bytes");
+    if (options.huffmanTables < 1 || options.huffmanTables > MAX_HUFFMAN_TABLES)
+        throw std::runtime_error("Huffman table count must be between 1 and " + std::to_string(MAX_HUFFMAN_TABLES));
+    if (options.refinePasses < 1 || options.refinePasses > MAX_REFINE_PASSES)
+        throw std::runtime_error("Refinement passes must be between 1 and " + std::to_string(MAX_REFINE_PASSES));
     if (originalExt.length() > 64) throw std::runtime_error("Unreasonable original extension length (>64)");
+}
 
-    std::ofstream outFile(outputFile, std::ios::binary);
-    outFile.exceptions(std::ofstream::failbit | std::ofstream::badbit);
+// Magic, container version, block size and the original extension
+void Compressor::putFileHeader(std::vector<uint8_t> &out, size_t blockSize, const std::string &originalExt) {
+    out.insert(out.end(), RSK_MAGIC, RSK_MAGIC + 3);
+    out.push_back(RSK_VERSION);
+    putU32(out, static_cast<uint32_t>(blockSize));
+    putU32(out, static_cast<uint32_t>(originalExt.length()));
+    out.insert(out.end(), originalExt.begin(), originalExt.end());
+}
 
-    if (!outFile.is_open()) 
-        throw std::runtime_error("Failed to create output file"); 
+// Zero length block marks the end of the block stream at offset endOfBlocks, the block index follows it
+// The footer's CRC of the whole input is combined from the block CRCs
+void Compressor::putBlockIndex(std::vector<uint8_t> &out, const std::vector<BlockIndexEntry> &index, uint64_t endOfBlocks) {
+    putU32(out, 0);
+    putU32(out, static_cast<uint32_t>(index.size()));
+    uint32_t crc = 0;
+    for (const BlockIndexEntry &entry : index) {
+        putU64(out, entry.offset);
+        putU32(out, entry.compressedSize);
+        putU32(out, entry.originalSize);
+        crc = Crc32c::combine(crc, entry.crc, entry.originalSize);
+    }
+    putU64(out, endOfBlocks + 4);
+    putU32(out, crc);
+    out.insert(out.end(), RSK_INDEX_MAGIC, RSK_INDEX_MAGIC + 4);
+}
 
-    try {
-        // Write extension length and extension first
-        uint32_t extLen = originalExt.length();
-        outFile.write(reinterpret_cast<const char *>(&extLen), sizeof(extLen));
-        outFile.write(originalExt.c_str(), extLen);
-
-        // Store size of frequecy table
-        uint32_t tableSize = frequencyTable.size();
-        outFile.write(reinterpret_cast<const char *>(&tableSize), sizeof(tableSize));
-
-        // Store frequency table for deccompression purposes
-        for (const auto &pair : frequencyTable) {
-            outFile.write(reinterpret_cast<const char *>(&pair.first), sizeof(pair.first));
-            outFile.write(reinterpret_cast<const char *>(&pair.second), sizeof(pair.second));
+// Write the file header, then run the input through a BlockPipeline: a reader thread takes blocks
+// from nextBlock, the workers compress them and this thread appends them in order
+// Reading, compressing and writing overlap, and memory does not grow with the input size
+// Finish with the block index so readers can locate every block
+std::pair<size_t, size_t> Compressor::writeBlocks(
+    const BlockReader &nextBlock,
+    std::ostream &out,
+    const CompressionOptions &options,
+    const std::string &originalExt
+) {
+    Compressor::checkOptions(options, originalExt);
+
+    std::vector<uint8_t> header;
+    Compressor::putFileHeader(header, options.blockSize, originalExt);
+    out.write(reinterpret_cast<const char *>(header.data()), header.size());
+    if (!out) throw std::runtime_error("Failed writing file header");
+
+    std::vector<BlockIndexEntry> index;
+    uint64_t offset = header.size();
+    size_t inputSize = 0;
+
+    BlockPipeline<CompressJob>::run(
+        [&](CompressJob &job) {
+            PipelineStats::Timer timer(options.stats, Stage::Read);
+            if (!nextBlock(job.data, job.size, job.input)) return false;
+            inputSize += job.size;
+            return true;
+        },
+        [&options](CompressJob &job) {
+            // Each worker keeps the block sized buffers of its scratch for the whole run
+            thread_local Compressor::Scratch scratch;
+            job.block.clear();
+            Compressor::compressBlock(job.data, job.size, options, scratch, job.block);
+        },
+        [&](CompressJob &job) {
+            const std::vector<uint8_t> &block = job.block;
+            PipelineStats::Timer timer(options.stats, Stage::Write);
+            out.write(reinterpret_cast<const char *>(block.data()), block.size());
+            if (!out) throw std::runtime_error("Failed writing compressed block");
+            index.push_back({offset, static_cast<uint32_t>(block.size()), getU32(block.data()), getU32(block.data() + 8)});
+            offset += block.size();
+        },
+        options.threads);
+
+    std::vector<uint8_t> trailer;
+    Compressor::putBlockIndex(trailer, index, offset);
+    PipelineStats::Timer timer(options.stats, Stage::Write);
+    out.write(reinterpret_cast<const char *>(trailer.data()), trailer.size());
+    out.flush();
+    if (!out) throw std::runtime_error("Failed writing block index");
+
+    return std::make_pair(inputSize, static_cast<size_t>(offset + trailer.size()));
+}
+
+// Compress a sequentially read input, such as a pipe
+// Blocks are read into the pipeline's recycled buffers
+std::pair<size_t, size_t> Compressor::CompressStream(
+    std::istream &in,
+    std::ostream &out,
+    const CompressionOptions &options,
+    const std::string &originalExt
+) {
+    bool done = false;
+    auto nextBlock = [&](const uint8_t *&data, size_t &size, std::vector<uint8_t> &buffer) {
+        if (done) return false;
+        buffer.resize(options.blockSize);
+        in.read(reinterpret_cast<char *>(buffer.data()), buffer.size());
+        size = static_cast<size_t>(in.gcount());
+        if (in.bad()) throw std::runtime_error("I/O error while reading input");
+        // A short read only happens at the end of the input
+        done = size < options.blockSize;
+        if (size == 0) return false;
+        data = buffer.data();
+        return true;
+    };
+    return Compressor::writeBlocks(nextBlock, out, options, originalExt);
+}
+
+// Compress a buffer into an in-memory .rsk image, one block after the other on the calling thread
+// Blocks are appended straight to out, which the caller may keep to reuse its capacity
+void Compressor::CompressBuffer(const uint8_t *data, size_t size, const CompressionOptions &options,
+                                Scratch &scratch, std::vector<uint8_t> &out) {
+    Compressor::checkOptions(options, "");
+    out.clear();
+    Compressor::putFileHeader(out, options.blockSize, "");
+
+    std::vector<BlockIndexEntry> index;
+    for (size_t offset = 0; offset < size; offset += options.blockSize) {
+        size_t blockStart = out.size();
+        size_t blockSize = std::min(options.blockSize, size - offset);
+        Compressor::compressBlock(data + offset, blockSize, options, scratch, out);
+        index.push_back({blockStart, static_cast<uint32_t>(out.size() - blockStart), static_cast<uint32_t>(blockSize),
+                         getU32(out.data() + blockStart + 8)});
+    }
+    Compressor::putBlockIndex(out, index, out.size());
+}
+
+// Compress one block through the whole pipeline with its own Huffman code
+// Returns the framed block ready to be appended to the output file
+std::vector<uint8_t> Compressor::compressBlock(const uint8_t *data, size_t size, const CompressionOptions &options) {
+    Scratch scratch;
+    std::vector<uint8_t> block;
+    Compressor::compressBlock(data, size, options, scratch, block);
+    return block;
+}
+
+// Compress one block, appending the framed block to block
+// The buffers sized by the block live in scratch, so a caller that keeps it reuses them across blocks
+uint64_t Compressor::compressBlock(const uint8_t *data, size_t size, const CompressionOptions &options,
+                                   Scratch &scratch, std::vector<uint8_t> &block) {
+    PipelineStats *stats = options.stats;
+    if (stats) stats->countData(data, size);
+    uint32_t crc = PipelineStats::measure(stats, Stage::Checksum, [&]() { return Crc32c::compute(data, size); });
+    size_t blockStart = block.size();
+
+    // Blocks the BWT will not help skip it, or skip coding altogether
+    // The trial runs the full pipeline on a slice of the block, through the same scratch buffers
+    BlockMode mode = options.useBWT ? BlockMode::Full : BlockMode::HuffmanOnly;
+    std::vector<uint8_t> trialBlock;
+    uint64_t trialBits = 0;
+    if (options.sampleBlocks && !options.useBWT) {
+        mode = PipelineStats::measure(stats, Stage::Sampling, [&]() { return BlockSampler::choose(data, size, nullptr); });
+    } else if (options.sampleBlocks) {
+        mode = PipelineStats::measure(stats, Stage::Sampling, [&]() {
+            return BlockSampler::choose(data, size, [&](const uint8_t *slice, size_t sliceSize) {
+                CompressionOptions trialOptions = options;
+                trialOptions.sampleBlocks = false;
+                trialOptions.stats = nullptr;
+                trialBlock.clear();
+                trialBits = Compressor::compressBlock(slice, sliceSize, trialOptions, scratch, trialBlock);
+                if (trialBlock[BLOCK_FRAME_HEADER_SIZE + 4] & BLOCK_FLAG_STORED) return 8.0;
+                return static_cast<double>(trialBits) / sliceSize;
+            });
+        });
+    }
+
+    // A trial over the whole block, as on small blocks, already is the coded block
+    bool trialCoded = !trialBlock.empty() && !(trialBlock[BLOCK_FRAME_HEADER_SIZE + 4] & BLOCK_FLAG_STORED);
+    if (mode == BlockMode::Full && trialCoded && getU32(trialBlock.data()) == size) {
+        block.insert(block.end(), trialBlock.begin(), trialBlock.end());
+        if (stats) {
+            stats->countMTF(scratch.mtf.data(), size);
+            // Tables are numbered in order of first use, so the last one used is the highest selector
+            size_t tables = scratch.selectors.empty() ? 1 : *std::max_element(scratch.selectors.begin(), scratch.selectors.end()) + 1;
+            stats->addPayload(scratch.symbols.size(), trialBits, trialBlock[BLOCK_FRAME_HEADER_SIZE + 4] & BLOCK_FLAG_RANS, tables);
+            stats->countBlock(mode, size);
         }
+        return trialBits;
+    }
+    if (mode == BlockMode::Stored) {
+        PipelineStats::measure(stats, Stage::BitPacking, [&]() { Compressor::storeBlock(data, size, crc, block); });
+        if (stats) stats->countBlock(mode, size);
+        return 0;
+    }
 
-        // Store size of contents of original file
-        uint32_t originalSize = mtfEncoded.size();
-        outFile.write(reinterpret_cast<const char *>(&originalSize), sizeof(originalSize));
-        
-        outFile.write(reinterpret_cast<const char *>(&lastCol), sizeof(lastCol));
-
-        // Write main encoded character data
-        unsigned char currentByte = 0;
-        int bitPosition = 7;
-        size_t totalBits = 0;
-
-        // Encode and write
-        for (auto c : mtfEncoded) {
-            auto it = huffmanCodes.find(c);
-            if(it == huffmanCodes.end()) 
-                throw std::runtime_error("Character not found in huffman codes");
-           
-            const std::string &code = it->second;
-            for(char bit : code) {
-                if(bit == '1') currentByte |= (1 << bitPosition);
-                
-                bitPosition--;
-                totalBits++;
-
-                if (bitPosition < 0) {
-                    outFile.write(reinterpret_cast<char*>(&currentByte), 1);
-                    currentByte = 0;
-                    bitPosition = 7;
-                }
-            }
+    std::vector<uint16_t> &symbols = scratch.symbols;
+    size_t alphabetSize = ALPH_SIZE;
+    uint8_t flags = 0;
+    if (mode == BlockMode::HuffmanOnly) {
+        symbols.assign(data, data + size);
+        scratch.bwtCursors.assign(1, 0);
+        flags = BLOCK_FLAG_NO_BWT;
+    } else {
+        // Generate move the front encoding, highly suitable for huffman coding
+        // Huffman coding naturally exploits this skewed frequency distribution by assigning shorted codes to frequenct symbols
+        size_t lastCol = PipelineStats::measure(stats, Stage::BWT, [&]() {
+            return Compressor::BWTEncoding(data, size, options.engine, scratch.suffixArray, scratch.lastColumn, scratch.bwtCursors);
+        });
+        if (scratch.lastColumn.empty()) throw std::runtime_error("BWT encoding failed: produced empty output");
+        if (lastCol == static_cast<size_t>(-1)) throw std::runtime_error("BWT encoding failed: original index not found");
+        std::vector<uint8_t> &mtfEncoded = scratch.mtf;
+        PipelineStats::measure(stats, Stage::MTF, [&]() {
+            mtfEncoded.resize(size);
+            MoveToFront::encode(reinterpret_cast<const uint8_t *>(scratch.lastColumn.data()), size, mtfEncoded.data());
+        });
+        if (stats) stats->countMTF(mtfEncoded.data(), mtfEncoded.size());
+
+        // Long zero runs collapse into a few RUNA/RUNB digits, otherwise every MTF value is coded
+        if (options.zeroRuns) {
+            PipelineStats::measure(stats, Stage::ZeroRuns, [&]() {
+                ZeroRunLength::encode(mtfEncoded.data(), mtfEncoded.size(), symbols);
+            });
+            alphabetSize = ZeroRunLength::ALPHABET_SIZE;
+            flags |= BLOCK_FLAG_ZERO_RUNS;
+        } else {
+            symbols.assign(mtfEncoded.begin(), mtfEncoded.end());
         }
+    }
 
-        if(bitPosition != 7) 
-            outFile.write(reinterpret_cast<const char*>(&currentByte), 1);
+    // Length limited code lengths for every Huffman table and the table chosen for each group of symbols
+    PipelineStats::measure(stats, Stage::Histogram, [&]() {
+        scratch.counts.resize(alphabetSize);
+        Histogram::countSymbols(symbols.data(), symbols.size(), alphabetSize, scratch.counts.data());
+    });
+    std::vector<std::vector<uint8_t>> codeLengths = PipelineStats::measure(stats, Stage::TreeBuild, [&]() {
+        return huffmanTree::buildGroupedCodeLengths(symbols, scratch.counts, MAX_CODE_LENGTH, options.huffmanTables,
+                                                    options.refinePasses, scratch.selectors);
+    });
+    // rANS keeps the table grouping, it only codes each table closer to its entropy
+    if (options.rans && PipelineStats::measure(stats, Stage::TreeBuild, [&]() {
+            return Compressor::chooseRans(symbols, scratch.counts, codeLengths, scratch.selectors, scratch.frequencies);
+        }))
+        flags |= BLOCK_FLAG_RANS;
+
+    uint64_t payloadBits = PipelineStats::measure(stats, Stage::BitPacking, [&]() {
+        return Compressor::encodeBlock(symbols, size, crc, flags, codeLengths, scratch.frequencies, scratch.selectors,
+                                       scratch.bwtCursors, block);
+    });
+
+    // A block that came out larger than its bytes is stored instead
+    if (block.size() - blockStart > BLOCK_FRAME_HEADER_SIZE + STORED_BLOCK_HEADER_SIZE + size) {
+        block.resize(blockStart);
+        Compressor::storeBlock(data, size, crc, block);
+        if (stats) stats->countBlock(BlockMode::Stored, size);
+        return 0;
+    }
+    if (stats) {
+        stats->addPayload(symbols.size(), payloadBits, flags & BLOCK_FLAG_RANS, codeLengths.size());
+        stats->countBlock(mode, size);
+    }
+    return payloadBits;
+}
 
-        // Calculating the padding for 8 bits
-        uint8_t paddingBits = (8 - (totalBits % 8)) % 8;
-        if (paddingBits > 7) throw std::runtime_error("Calculated invalid padding bits");
-        outFile.write(reinterpret_cast<const char *>(&paddingBits), sizeof(paddingBits));
+// Write the block frame and the original bytes of a block that is not worth coding
+void Compressor::storeBlock(const uint8_t *data, size_t size, uint32_t crc, std::vector<uint8_t> &block) {
+    if (size > MAX_BLOCK_SIZE) throw std::runtime_error("Block exceeds maximum block size");
+    putU32(block, static_cast<uint32_t>(size));
+    putU32(block, static_cast<uint32_t>(STORED_BLOCK_HEADER_SIZE + size));
+    putU32(block, crc);
+    putU32(block, 0);
+    block.push_back(BLOCK_FLAG_STORED);
+    block.insert(block.end(), data, data + size);
+}
 
-        std::cout << "File has been successfully compressed and saved as " 
-             << outputFile << std::endl;
+// Count the symbols of every table and compare the Huffman codes with rANS frequencies for the same
+// tables: payload estimated from the counts, tables and stream sizes or lane states exactly
+bool Compressor::chooseRans(
+    const std::vector<uint16_t> &symbols,
+    const std::vector<size_t> &counts,
+    const std::vector<std::vector<uint8_t>> &codeLengths,
+    const std::vector<uint8_t> &selectors,
+    std::vector<std::vector<uint16_t>> &frequencies
+) {
+    // A single symbol costs Huffman nothing
+    if (counts.size() - std::count(counts.begin(), counts.end(), 0) < 2) return false;
+
+    size_t alphabetSize = codeLengths.front().size();
+    std::vector<size_t> tableCounts(codeLengths.size() * alphabetSize, 0);
+    for (size_t group = 0; group < selectors.size(); group++) {
+        size_t *groupCounts = tableCounts.data() + selectors[group] * alphabetSize;
+        size_t end = std::min((group + 1) * HUFFMAN_GROUP_SIZE, symbols.size());
+        for (size_t i = group * HUFFMAN_GROUP_SIZE; i < end; i++) groupCounts[symbols[i]]++;
     }
-    catch(const std::exception &e) {
-        throw std::runtime_error(
-            std::string("Failed writing compressed output file: ") + e.what()
-        );
+
+    double huffmanBits = 32 * HUFFMAN_STREAMS;
+    double ransBits = 32 * RANS_LANES;
+    frequencies.resize(codeLengths.size());
+    for (size_t t = 0; t < codeLengths.size(); t++) {
+        const size_t *used = tableCounts.data() + t * alphabetSize;
+        for (size_t symbol = 0; symbol < alphabetSize; symbol++) huffmanBits += used[symbol] * codeLengths[t][symbol];
+        // A table no group picked still needs frequencies that sum to the scale
+        if (std::all_of(used, used + alphabetSize, [](size_t count) { return count == 0; })) used = counts.data();
+        frequencies[t].resize(alphabetSize);
+        Rans::normalize(used, alphabetSize, frequencies[t].data());
+        ransBits += Rans::cost(used, frequencies[t].data(), alphabetSize);
     }
+
+    std::vector<uint8_t> tables;
+    huffmanTree::writeCodeLengths(codeLengths, tables);
+    huffmanBits += 8.0 * tables.size();
+    tables.clear();
+    Rans::writeFrequencies(frequencies, tables);
+    ransBits += 8.0 * tables.size();
+    return ransBits < huffmanBits;
+}
+
+// Write the block frame and header data and then write all huffman codes
+// Only the code lengths are stored, the decoder rebuilds the canonical codes from them
+// With BLOCK_FLAG_RANS the frequencies and the rANS payload take the place of code lengths and codes
+// Returns the number of coded payload bits
+uint64_t Compressor::encodeBlock(
+    const std::vector<uint16_t> &symbols,
+    size_t originalSize,
+    uint32_t crc,
+    uint8_t flags,
+    const std::vector<std::vector<uint8_t>> &codeLengths,
+    const std::vector<std::vector<uint16_t>> &frequencies,
+    const std::vector<uint8_t> &selectors,
+    const std::vector<size_t> &bwtCursors,
+    std::vector<uint8_t> &block
+) {
+    // Basic validations for header integrity
+    if (symbols.empty()) throw std::runtime_error("MTF-encoded content is empty; invalid input or encoding failure");
+    if (originalSize > MAX_BLOCK_SIZE) throw std::runtime_error("Block exceeds maximum block size");
+    if (bwtCursors.empty() || bwtCursors.size() > MAX_BWT_CURSORS || bwtCursors.size() > originalSize)
+        throw std::runtime_error("Invalid number of BWT cursors");
+    for (size_t row : bwtCursors)
+        if (row >= originalSize) throw std::runtime_error("Invalid BWT index; header cannot be written");
+    if (codeLengths.empty() || codeLengths.size() > MAX_HUFFMAN_TABLES) throw std::runtime_error("Invalid number of Huffman tables");
+    if (selectors.size() != (symbols.size() + HUFFMAN_GROUP_SIZE - 1) / HUFFMAN_GROUP_SIZE) throw std::runtime_error("Selector count does not match the symbol groups");
+    size_t alphabetSize = codeLengths.front().size();
+    size_t symbolCount = alphabetSize - std::count(codeLengths.front().begin(), codeLengths.front().end(), 0);
+    if (symbolCount == 0) throw std::runtime_error("Code length table is empty; nothing to compress");
+
+    // Original block size and CRC, body size is patched in once the body is complete
+    putU32(block, static_cast<uint32_t>(originalSize));
+    size_t bodySizePos = block.size();
+    putU32(block, 0);
+    putU32(block, crc);
+    size_t bodyStart = block.size();
+
+    putU32(block, static_cast<uint32_t>(bwtCursors.back()));
+    block.push_back(flags);
+    block.push_back(static_cast<uint8_t>(bwtCursors.size() - 1));
+    for (size_t j = 0; j + 1 < bwtCursors.size(); j++) putU32(block, static_cast<uint32_t>(bwtCursors[j]));
+    if (flags & BLOCK_FLAG_ZERO_RUNS) putU32(block, static_cast<uint32_t>(symbols.size()));
+    block.push_back(static_cast<uint8_t>(codeLengths.size()));
+
+    // Store code lengths for deccompression purposes
+    bool rans = flags & BLOCK_FLAG_RANS;
+    if (rans && frequencies.size() != codeLengths.size()) throw std::runtime_error("rANS frequencies do not match the tables");
+    if (rans) Rans::writeFrequencies(frequencies, block);
+    else huffmanTree::writeCodeLengths(codeLengths, block);
+
+    // Selectors, move to front coded so runs of the same table cost one bit per group
+    if (codeLengths.size() > 1) {
+        uint8_t recent[MAX_HUFFMAN_TABLES];
+        for (int t = 0; t < MAX_HUFFMAN_TABLES; t++) recent[t] = static_cast<uint8_t>(t);
+        BitWriter writer(block, selectors.size() / 8);
+        for (uint8_t selector : selectors) {
+            int position = 0;
+            while (recent[position] != selector) position++;
+            for (int i = position; i > 0; i--) recent[i] = recent[i - 1];
+            recent[0] = selector;
+            writer.write((1u << (position + 1)) - 2, position + 1);
+        }
+        writer.finish();
+    }
+
+    // The rANS payload is whole words and runs to the end of the body, no sizes to record
+    if (rans) {
+        size_t payloadStart = block.size();
+        Rans::encode(symbols.data(), symbols.size(), selectors.data(), HUFFMAN_GROUP_SIZE, frequencies, block);
+        patchU32(block, bodySizePos, static_cast<uint32_t>(block.size() - bodyStart));
+        return 8 * static_cast<uint64_t>(block.size() - payloadStart);
+    }
+
+    // Stream sizes are known only at the end
+    size_t streamBitsPos = block.size();
+    for (size_t k = 0; k < HUFFMAN_STREAMS; k++) putU32(block, 0);
+
+    // A block of one repeated symbol is fully described by its header
+    uint64_t totalBits = 0;
+    if (symbolCount > 1) {
+        // Flat (code, length) table per Huffman table, one indexed load per symbol in the encode loop
+        struct CodeEntry {
+            uint32_t code;
+            int length;
+        };
+        std::vector<CodeEntry> codeTable(codeLengths.size() * alphabetSize);
+        for (size_t t = 0; t < codeLengths.size(); t++) {
+            std::vector<uint32_t> huffmanCodes = huffmanTree::canonicalCodes(codeLengths[t]);
+            for (size_t symbol = 0; symbol < alphabetSize; symbol++)
+                codeTable[t * alphabetSize + symbol] = {huffmanCodes[symbol], codeLengths[t][symbol]};
+        }
+
+        // Every stream codes its own run of groups through the bit writer, switching tables every group
+        for (size_t k = 0; k < HUFFMAN_STREAMS; k++) {
+            size_t firstGroup = huffmanStreamStart(selectors.size(), k);
+            size_t lastGroup = huffmanStreamStart(selectors.size(), k + 1);
+            BitWriter writer(block, (lastGroup - firstGroup) * HUFFMAN_GROUP_SIZE / 4);
+            for (size_t group = firstGroup; group < lastGroup; group++) {
+                const CodeEntry *codes = codeTable.data() + selectors[group] * alphabetSize;
+                size_t end = std::min((group + 1) * HUFFMAN_GROUP_SIZE, symbols.size());
+                for (size_t i = group * HUFFMAN_GROUP_SIZE; i < end; i++) {
+                    const CodeEntry &entry = codes[symbols[i]];
+                    if (entry.length == 0)
+                        throw std::runtime_error("Character not found in huffman codes");
+                    writer.write(entry.code, entry.length);
+                }
+            }
+            uint64_t streamBits = writer.finish();
+            patchU32(block, streamBitsPos + 4 * k, static_cast<uint32_t>(streamBits));
+            totalBits += streamBits;
+        }
+    }
+
+    patchU32(block, bodySizePos, static_cast<uint32_t>(block.size() - bodyStart));
+    return totalBits;
 }
 
 // Utility function to calculate the size of file
@@ -143,90 +544,102 @@ size_t Compressor::getFileSize(const std::string &filename) {
     return rc == 0 ? stat_buf.st_size : 0;
 }
 
+// Chains the inverse BWT follows at once for an n byte block
+// A single chain is enough while its links fit in the caches
+static size_t bwtCursorCount(size_t n) {
+    return std::min<size_t>(MAX_BWT_CURSORS, 1 + n / (128 * 1024));
+}
+
+// Builds the last column of the sorted rotation matrix into lastCol and the row of the rotation
+// starting at the end of every inverse BWT segment into cursors, the last one being the original row
+// Returns the row holding the original text
+template <typename Index>
+static size_t BWTFromOrder(const uint8_t *text, size_t n, const std::vector<Index> &order, std::string &lastCol,
+                           std::vector<size_t> &cursors) {
+    uint64_t segments = bwtCursorCount(n);
+    cursors.assign(segments, 0);
+    lastCol.resize(n);
+    size_t originalIndex = 0;
+    for (size_t i = 0; i < n; ++i) {
+        size_t start = static_cast<size_t>(order[i]);
+        lastCol[i] = static_cast<char>(text[start == 0 ? n - 1 : start - 1]);
+        if (start == 0) originalIndex = i;
+        // Segment j ends at floor((j + 1) * n / segments)
+        uint64_t j = (static_cast<uint64_t>(start) * segments + n - 1) / n;
+        if (j > 0 && j < segments && j * n / segments == start) cursors[j - 1] = i;
+    }
+    cursors.back() = originalIndex;
+    return originalIndex;
+}
+
 // Burrows–Wheeler Transform (BWT)
 // Rearranges data so similar characters cluster together
 // Makes data more repetitive without losing information
-std::pair<std::string, size_t> Compressor::BWTEncoding(std::string &fileContent) {
-    size_t n = fileContent.size();
-    if (n == 0) return {std::string(), static_cast<size_t>(-1)};
+std::pair<std::string, size_t> Compressor::BWTEncoding(const uint8_t *text, size_t n, BWTEngine engine) {
+    std::vector<int32_t> order;
+    std::string lastCol;
+    std::vector<size_t> cursors;
+    size_t originalIndex = Compressor::BWTEncoding(text, n, engine, order, lastCol, cursors);
+    return {lastCol, originalIndex};
+}
+
+// BWT into caller owned buffers, order is the suffix array scratch space
+// cursors receives the starting rows of the inverse BWT segments
+// Returns the row holding the original text
+size_t Compressor::BWTEncoding(const uint8_t *text, size_t n, BWTEngine engine, std::vector<int32_t> &order,
+                               std::string &lastCol, std::vector<size_t> &cursors) {
+    if (n == 0) {
+        lastCol.clear();
+        cursors.clear();
+        return static_cast<size_t>(-1);
+    }
+    if (engine == BWTEngine::RotationSort) return Compressor::BWTRotationSort(text, n, lastCol, cursors);
+
+    // Sort rotations in linear time through the suffix array of the doubled input
+    // 32-bit indices halve the scratch memory whenever the doubled input fits
+    if (n <= (INT32_MAX - 1) / 2) {
+        SuffixArray::sortRotations(text, n, order);
+        return BWTFromOrder(text, n, order, lastCol, cursors);
+    }
+    std::vector<int64_t> wideOrder;
+    SuffixArray::sortRotations(text, n, wideOrder);
+    return BWTFromOrder(text, n, wideOrder, lastCol, cursors);
+}
 
+// Reference BWT that compares whole cyclic rotations
+// O(n) per comparison on repetitive input, only used to cross-check the suffix array engine
+size_t Compressor::BWTRotationSort(const uint8_t *text, size_t n, std::string &lastCol, std::vector<size_t> &cursors) {
     // Sort rotation indices instead of building all rotations to save memory
     std::vector<size_t> idx(n);
     std::iota(idx.begin(), idx.end(), 0);
 
-    auto cmp = [&fileContent, n](size_t a, size_t b) {
+    auto cmp = [text, n](size_t a, size_t b) {
         // Compare cyclic rotations starting at a and b
         for (size_t k = 0; k < n; ++k) {
-            unsigned char ca = static_cast<unsigned char>(fileContent[(a + k) % n]);
-            unsigned char cb = static_cast<unsigned char>(fileContent[(b + k) % n]);
+            uint8_t ca = text[(a + k) % n];
+            uint8_t cb = text[(b + k) % n];
             if (ca < cb) return true;
             if (ca > cb) return false;
         }
-        return false; // equal rotations
+        // Equal rotations: descending start, the same order the suffix array engine yields
+        return a > b;
     };
 
     std::sort(idx.begin(), idx.end(), cmp);
-
-    std::string lastCol;
-    lastCol.reserve(n);
-    size_t originalIndex = 0;
-    for (size_t i = 0; i < n; ++i) {
-        size_t start = idx[i];
-        lastCol.push_back(fileContent[(start + n - 1) % n]);
-        if (start == 0) originalIndex = i;
-    }
-
-    return {lastCol, originalIndex};
+    return BWTFromOrder(text, n, idx, lastCol, cursors);
 }
 
 // Move to Front Encoding
 std::vector<uint8_t> Compressor::MTFEncoding(const std::string& inputString) {
-    std::list<char> symbols;
-    for(int i = 0; i < ALPH_SIZE; i++)
-        symbols.push_back((char)i);
-
-    std::vector<uint8_t> output;
-    output.reserve(inputString.size()); // Pre-allocate
-
-    for(char c : inputString) {
-        uint8_t idx = 0;
-        for(auto it = symbols.begin(); it != symbols.end(); ++it, ++idx) {
-            if(*it == c) {
-                output.push_back(idx);
-                symbols.erase(it);
-                symbols.push_front(c);
-                break;
-            }
-        }
-    }
+    std::vector<uint8_t> output(inputString.size());
+    MoveToFront::encode(reinterpret_cast<const uint8_t *>(inputString.data()), inputString.size(), output.data());
     return output;
 }
 
 // Main File Compression Utility
-std::pair<size_t, size_t> Compressor::Compress(const std::string &filename) {
-    std::map<uint8_t, size_t> frequencyMap;    
-    std::unordered_map<uint8_t, std::string> huffmanCodes; 
-    std::string fileContent;                      
+std::pair<size_t, size_t> Compressor::Compress(const std::string &filename, const CompressionOptions &options) {
     size_t inputFileSize = getFileSize(filename);
-    Compressor::readInputFileForCompression(filename, fileContent);
-    if (fileContent.empty()) throw std::runtime_error("Input file is empty: " + filename);
-
-    // Generate move the front encoding, highly suitable for huffman coding 
-    // Huffman coding naturally exploits this skewed frequency distribution by assigning shorted codes to frequenct symbols
-    std::pair<std::string, size_t> bwtEncoding = Compressor::BWTEncoding(fileContent);
-    if (bwtEncoding.first.empty()) throw std::runtime_error("BWT encoding failed: produced empty output");
-    if (bwtEncoding.second == static_cast<size_t>(-1)) throw std::runtime_error("BWT encoding failed: original index not found");
-    std::vector<uint8_t> mtfEncoded = Compressor::MTFEncoding(bwtEncoding.first);
-
-    // Calculate frequencies
-    for(int num : mtfEncoded) frequencyMap[num]++;
-
-    // Build the huffman tree and get its root node
-    std::shared_ptr<minHeapNode> root = huffmanTree::buildHuffmanTree(frequencyMap);
-    if (!root) throw std::runtime_error("Failed to build Huffman tree");
-    
-    // Store Huffman codes
-    huffmanTree::saveCodes(root.get(), "", huffmanCodes);
+    if (inputFileSize == 0) throw std::runtime_error("Input file is empty or missing: " + filename);
 
     // Extract original extension
     size_t dotPos = filename.rfind('.');
@@ -235,7 +648,7 @@ std::pair<size_t, size_t> Compressor::Compress(const std::string &filename) {
     std::string outFile = baseFilename + ".rsk";
 
     // Write the output compressed file
-    Compressor::writeCompressedFile(mtfEncoded, frequencyMap, huffmanCodes, outFile, originalExt, bwtEncoding.second);
+    Compressor::writeCompressedFile(filename, options, outFile, originalExt);
 
     size_t outputFileSize = getFileSize(outFile); // Calculate output file size
     return std::make_pair(inputFileSize, outputFileSize);
@@ -5,28 +5,124 @@
 #include <map>
 #include <utility>
 #include <unordered_map>
+#include <iosfwd>
+#include <functional>
+#include <memory>
+#include "rskFormat.h"
+
+class PipelineStats;
+
+// Compression levels, from fastest (Huffman only) to strongest (largest blocks, most refinement)
+#define MIN_COMPRESSION_LEVEL 1
+#define MAX_COMPRESSION_LEVEL 9
+#define DEFAULT_COMPRESSION_LEVEL 6
+
+// Rotation sorting engine used by the Burrows-Wheeler Transform
+enum class BWTEngine {
+    InducedSorting,  // Linear time SA-IS suffix sorting (default)
+    RotationSort     // Comparison sort of whole rotations, kept for cross-checking
+};
+
+// Settings for a compression run, the defaults are DEFAULT_COMPRESSION_LEVEL
+struct CompressionOptions {
+    BWTEngine engine = BWTEngine::InducedSorting;
+    size_t blockSize = DEFAULT_BLOCK_SIZE;  // Input bytes per independently coded block
+    size_t threads = 0;                     // Worker threads, 0 sizes the pool to the machine
+    bool useBWT = true;                     // Otherwise every block is Huffman coded as it is
+    bool zeroRuns = true;                   // Code MTF zero runs as RUNA/RUNB symbols ahead of Huffman
+    size_t huffmanTables = MAX_HUFFMAN_TABLES;  // Most Huffman tables a block may switch between
+    int refinePasses = 4;                   // Passes that move symbol groups between the Huffman tables
+    bool sampleBlocks = true;               // Store or only Huffman code blocks the BWT will not help
+    bool rans = true;                       // rANS code blocks where it beats Huffman
+    PipelineStats *stats = nullptr;         // Collects stage timings and coding statistics when set
+
+    // Engine settings of a level between MIN_COMPRESSION_LEVEL and MAX_COMPRESSION_LEVEL
+    static CompressionOptions forLevel(int level);
+};
 
 class Compressor {
-    static void readInputFileForCompression(
-        const std::string &filename, 
-        std::string &fileContent
+    static void putFileHeader(std::vector<uint8_t> &out, size_t blockSize, const std::string &originalExt);
+
+    static void writeCompressedFile(const std::string &filename,
+        const CompressionOptions &options,
+        const std::string &outputFile,
+        const std::string &originalExt
     );
-    
-    static void writeCompressedFile(const std::vector<uint8_t> &mtfEncoded, 
-        const std::map<uint8_t, size_t> &frequencyTable, 
-        const std::unordered_map<uint8_t, std::string> &huffmanCodes, 
-        const std::string &outputFile, 
-        const std::string &originalExt,
-        const size_t lastCol
+
+    // Hands out the next input block as size bytes at data, which either outlive the run or were read
+    // into buffer. buffer is recycled from earlier blocks. Returns false at the end of the input
+    using BlockReader = std::function<bool(const uint8_t *&data, size_t &size, std::vector<uint8_t> &buffer)>;
+
+    static std::pair<size_t, size_t> writeBlocks(const BlockReader &nextBlock,
+        std::ostream &out,
+        const CompressionOptions &options,
+        const std::string &originalExt
     );
 
     static size_t getFileSize(const std::string &filename);
 
-    static std::pair<std::string, size_t> BWTEncoding(std::string &fileContent);
-    static std::vector<uint8_t> MTFEncoding(const std::string &inputString);
-    
+    static void storeBlock(const uint8_t *data, size_t size, uint32_t crc, std::vector<uint8_t> &block);
+
+    static size_t BWTRotationSort(const uint8_t *text, size_t n, std::string &lastCol, std::vector<size_t> &cursors);
+
 public:
-    static std::pair<size_t, size_t> Compress(const std::string &filename) ;
+    // Container pieces shared with the archive writer
+    static void checkOptions(const CompressionOptions &options, const std::string &originalExt);
+    static void putBlockIndex(std::vector<uint8_t> &out, const std::vector<BlockIndexEntry> &index, uint64_t endOfBlocks);
+
+    // Intermediate buffers of the block pipeline
+    // Kept between blocks by callers that compress many of them on one thread, so the buffers sized by
+    // the block are reused; the per-table buffers of the Huffman and rANS stages are still allocated per block
+    struct Scratch {
+        std::vector<int32_t> suffixArray;
+        std::string lastColumn;
+        std::vector<size_t> bwtCursors;
+        std::vector<uint8_t> mtf;
+        std::vector<uint16_t> symbols;
+        std::vector<size_t> counts;
+        std::vector<uint8_t> selectors;
+        std::vector<std::vector<uint16_t>> frequencies;
+    };
+
+    // Pipeline stages of one block, public so they can be measured one at a time
+    static std::vector<uint8_t> compressBlock(const uint8_t *data, size_t size, const CompressionOptions &options);
+    // Returns the coded payload bits, 0 for a stored block
+    static uint64_t compressBlock(const uint8_t *data, size_t size, const CompressionOptions &options,
+        Scratch &scratch, std::vector<uint8_t> &block);
+
+    // rANS frequencies for the symbols, grouped by selectors as they are for the Huffman tables
+    // Returns true when rANS is estimated to code them smaller than the Huffman tables do
+    static bool chooseRans(const std::vector<uint16_t> &symbols,
+        const std::vector<size_t> &counts,
+        const std::vector<std::vector<uint8_t>> &codeLengths,
+        const std::vector<uint8_t> &selectors,
+        std::vector<std::vector<uint16_t>> &frequencies
+    );
+    static uint64_t encodeBlock(const std::vector<uint16_t> &symbols,
+        size_t originalSize,
+        uint32_t crc,                           // CRC32C of the original bytes
+        uint8_t flags,                          // With BLOCK_FLAG_RANS frequencies code the symbols
+        const std::vector<std::vector<uint8_t>> &codeLengths,
+        const std::vector<std::vector<uint16_t>> &frequencies,
+        const std::vector<uint8_t> &selectors,
+        const std::vector<size_t> &bwtCursors,  // Inverse BWT segment rows, the BWT index last
+        std::vector<uint8_t> &block
+    );
+
+    static std::pair<std::string, size_t> BWTEncoding(const uint8_t *text, size_t n, BWTEngine engine);
+    static size_t BWTEncoding(const uint8_t *text, size_t n, BWTEngine engine,
+        std::vector<int32_t> &order, std::string &lastCol, std::vector<size_t> &cursors);
+    static std::vector<uint8_t> MTFEncoding(const std::string &inputString);
+
+    static std::pair<size_t, size_t> CompressStream(std::istream &in, std::ostream &out,
+        const CompressionOptions &options = CompressionOptions(),
+        const std::string &originalExt = "");
+    static std::pair<size_t, size_t> Compress(const std::string &filename, const CompressionOptions &options = CompressionOptions());
+
+    // Compress size bytes at data into a complete .rsk image in out, on the calling thread
+    // out is replaced; options.threads is ignored
+    static void CompressBuffer(const uint8_t *data, size_t size, const CompressionOptions &options,
+        Scratch &scratch, std::vector<uint8_t> &out);
 };
 
 #endif // COMPRESSOR_H
\ No newline at end of file
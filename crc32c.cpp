@@ -0,0 +1,107 @@
+#include "crc32c.h"
+#include <cstring>
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <nmmintrin.h>
+#define CRC32C_HARDWARE 1
+#endif
+
+#define CRC32C_POLY 0x82F63B78u
+
+namespace {
+
+// table[k][b] is the CRC of byte b followed by k zero bytes
+struct SliceTables {
+    uint32_t table[8][256];
+
+    SliceTables() {
+        for (uint32_t b = 0; b < 256; b++) {
+            uint32_t crc = b;
+            for (int bit = 0; bit < 8; bit++) crc = (crc >> 1) ^ (CRC32C_POLY & (0u - (crc & 1)));
+            table[0][b] = crc;
+        }
+        for (uint32_t b = 0; b < 256; b++)
+            for (int k = 1; k < 8; k++) table[k][b] = (table[k - 1][b] >> 8) ^ table[0][table[k - 1][b] & 0xFF];
+    }
+};
+
+const SliceTables &sliceTables() {
+    static const SliceTables tables;
+    return tables;
+}
+
+// Eight bytes per step through eight table lookups, bytes before and after one at a time
+uint32_t updateSliced(uint32_t crc, const uint8_t *p, size_t n) {
+    const uint32_t (*t)[256] = sliceTables().table;
+    while (n >= 8) {
+        uint32_t low, high;
+        std::memcpy(&low, p, 4);
+        std::memcpy(&high, p + 4, 4);
+        low ^= crc;
+        crc = t[7][low & 0xFF] ^ t[6][(low >> 8) & 0xFF] ^ t[5][(low >> 16) & 0xFF] ^ t[4][low >> 24] ^
+              t[3][high & 0xFF] ^ t[2][(high >> 8) & 0xFF] ^ t[1][(high >> 16) & 0xFF] ^ t[0][high >> 24];
+        p += 8;
+        n -= 8;
+    }
+    while (n--) crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xFF];
+    return crc;
+}
+
+#if CRC32C_HARDWARE
+__attribute__((target("sse4.2")))
+uint32_t updateHardware(uint32_t crc, const uint8_t *p, size_t n) {
+    uint64_t crc64 = crc;
+    while (n >= 8) {
+        uint64_t word;
+        std::memcpy(&word, p, 8);
+        crc64 = _mm_crc32_u64(crc64, word);
+        p += 8;
+        n -= 8;
+    }
+    crc = static_cast<uint32_t>(crc64);
+    while (n--) crc = _mm_crc32_u8(crc, *p++);
+    return crc;
+}
+
+bool hasHardwareCrc() {
+    static const bool supported = __builtin_cpu_supports("sse4.2");
+    return supported;
+}
+#endif
+
+// Product of two polynomials modulo the CRC polynomial, bit 31 holding x^0
+uint32_t multiplyModPoly(uint32_t a, uint32_t b) {
+    uint32_t product = 0;
+    for (uint32_t m = 1u << 31; m; m >>= 1) {
+        if (a & m) product ^= b;
+        b = (b >> 1) ^ (CRC32C_POLY & (0u - (b & 1)));
+    }
+    return product;
+}
+
+// x^(8 * bytes) modulo the CRC polynomial, from the squares x^(2^k)
+uint32_t shiftBytes(uint64_t bytes) {
+    uint32_t result = 1u << 31;  // x^0
+    uint32_t square = 1u << 23;  // x^8, a one byte shift
+    while (bytes) {
+        if (bytes & 1) result = multiplyModPoly(square, result);
+        square = multiplyModPoly(square, square);
+        bytes >>= 1;
+    }
+    return result;
+}
+
+} // namespace
+
+uint32_t Crc32c::update(uint32_t crc, const uint8_t *data, size_t n) {
+    crc = ~crc;
+#if CRC32C_HARDWARE
+    if (hasHardwareCrc()) return ~updateHardware(crc, data, n);
+#endif
+    return ~updateSliced(crc, data, n);
+}
+
+// Appending lengthB zero bytes to A multiplies its register by x^(8 * lengthB); the pre and post
+// inversions cancel out between the two parts, so B's CRC is simply added
+uint32_t Crc32c::combine(uint32_t crcA, uint32_t crcB, uint64_t lengthB) {
+    return multiplyModPoly(shiftBytes(lengthB), crcA) ^ crcB;
+}
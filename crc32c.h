@@ -0,0 +1,19 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+#include <cstddef>
+#include <cstdint>
+
+// CRC32C (Castagnoli polynomial, reflected), the checksum of iSCSI, ext4 and the SSE4.2 crc32 instruction
+// Uses the instruction when the CPU has it and slice-by-8 tables otherwise
+class Crc32c {
+public:
+    // Continues crc, the CRC of the bytes before data, over data[0..n); the CRC of nothing is 0
+    static uint32_t update(uint32_t crc, const uint8_t *data, size_t n);
+    static uint32_t compute(const uint8_t *data, size_t n) { return update(0, data, n); }
+
+    // CRC of the concatenation A + B from the CRCs of A and B and the length of B
+    // Lets blocks be checksummed in parallel and still give the CRC of the whole input
+    static uint32_t combine(uint32_t crcA, uint32_t crcB, uint64_t lengthB);
+};
+
+#endif // CRC32C_H
@@ -3,97 +3,89 @@
 #include <fstream>
 #include <ios>
 #include <string>
-#include <list>
 #include <map>
 #include <unordered_map>
 #include <vector>
 #include <utility>
-#include <sys/stat.h>
+#include <stdexcept>
+#include <cstddef>
+#include <cstring>
+#include <deque>
+#include <future>
+#include <memory>
+#include <algorithm>
+#include <functional>
 #include "huffmanTree.h"
+#include "huffmanDecoder.h"
+#include "rans.h"
+#include "rskFormat.h"
+#include "threadPool.h"
+#include "blockPipeline.h"
+#include "mappedFile.h"
+#include "moveToFront.h"
+#include "zeroRunLength.h"
+#include "pipelineStats.h"
+#include "crc32c.h"
 
 #define ALPH_SIZE 256
 
-// Create Frequency table from header data
-// Read the compressed input file for decompreesion
-// Read the header and encoded content
-// Create Frequency table from header data
-void Decompressor::readFromFileForDecompression(
-    const std::string &inputFile, 
-    std::string &originalExt, 
-    std::map<uint8_t, size_t> &frequencyTable, 
-    uint32_t &originalSize, 
-    std::string &bitString,
-    size_t &lastCol
-) {
-    // Open the file
-    std::ifstream inFile(inputFile, std::ios::binary);
-    if (!inFile) throw std::runtime_error("Failed to open file " + inputFile); 
+// Validate the fixed part of the file header: magic, container version and block size
+// Returns the length of the original extension that follows it
+uint32_t Decompressor::parseFileHeader(const uint8_t *header, const std::string &inputFile, uint32_t &blockSize) {
+    if (std::string(reinterpret_cast<const char *>(header), 3) != RSK_MAGIC)
+        throw std::runtime_error(inputFile + " is not an .rsk file");
+    if (header[3] != RSK_VERSION)
+        throw std::runtime_error("Unsupported .rsk container version " + std::to_string(header[3]));
+
+    blockSize = getU32(header + 4);
+    if (blockSize < MIN_BLOCK_SIZE || blockSize > MAX_BLOCK_SIZE) throw std::runtime_error("Corrupt header: invalid block size");
+    uint32_t extLen = getU32(header + 8);
+    if (extLen > 64) throw std::runtime_error("Corrupt header: unreasonable extension length (>64)");
+    return extLen;
+}
 
+// Read and validate the file header of a sequentially read input
+void Decompressor::readFileHeader(
+    std::istream &inFile,
+    const std::string &inputFile,
+    std::string &originalExt,
+    uint32_t &blockSize
+) {
     try {
+        uint8_t header[RSK_FILE_HEADER_SIZE];
+        inFile.read(reinterpret_cast<char *>(header), RSK_FILE_HEADER_SIZE);
+        if (inFile.fail()) throw std::runtime_error(inputFile + " is not an .rsk file");
+        uint32_t extLen = Decompressor::parseFileHeader(header, inputFile, blockSize);
+
         // Read the original Extension
-        uint32_t extLen;
-        inFile.read(reinterpret_cast<char *>(&extLen), sizeof(extLen));
-        if (inFile.fail()) throw std::runtime_error("Failed reading extension length from " + inputFile);
-        if (extLen > 64) throw std::runtime_error("Corrupt header: unreasonable extension length (>64)");
         std::string ext;
         ext.resize(extLen);
         inFile.read(&ext[0], extLen);
         if (inFile.fail()) throw std::runtime_error("Failed reading extension data from " + inputFile);
         originalExt = ext;
+    }
+    catch(const std::exception &e) {
+        throw std::runtime_error(
+            std::string("Failed while reading input file: ") + e.what()
+        );
+    }
+}
 
-        // Read the table size
-        uint32_t tableSize;
-        inFile.read(reinterpret_cast<char *>(&tableSize), sizeof(tableSize));
-        if (inFile.fail()) throw std::runtime_error("Failed reading frequency table size from " + inputFile);
-        if (tableSize > 256) throw std::runtime_error("Corrupt header: unreasonable frequency table size (>256)");
-
-        // Read the frequency table
-        for (uint32_t i = 0; i < tableSize; i++) {
-            unsigned char character;
-            size_t frequency;
-            inFile.read(reinterpret_cast<char *>(&character), sizeof(character));
-            inFile.read(reinterpret_cast<char *>(&frequency), sizeof(frequency));
-            if (inFile.fail()) throw std::runtime_error("Failed reading frequency table entry from " + inputFile);
-            frequencyTable[character] = frequency;
-        }
-
-        // Read the original content size
-        inFile.read(reinterpret_cast<char *>(&originalSize), sizeof(originalSize));
-        if (inFile.fail()) throw std::runtime_error("Failed reading original size from " + inputFile);
-        if (originalSize == 0) throw std::runtime_error("Corrupt header: original size is zero");
-
-        inFile.read(reinterpret_cast<char *>(&lastCol), sizeof(lastCol));
-        if (inFile.fail()) throw std::runtime_error("Failed column index for bwt decoding size from " + inputFile);
-
-        // Read the encoded data FIRST
-        std::vector<unsigned char> bytes;
-        unsigned char byte;
-        
-        // Read until we hit the last byte (which is the padding info)
-        while (inFile.read(reinterpret_cast<char *>(&byte), 1)) {
-            bytes.push_back(byte);
-        }
-        
-        if (inFile.bad()) throw std::runtime_error("I/O error while reading encoded data from " + inputFile);
-        if (bytes.empty()) throw std::runtime_error("No encoded data found in " + inputFile);
-        
-        // The LAST byte is the padding information
-        unsigned char paddingBits = bytes.back();
-        if (paddingBits > 7) throw std::runtime_error("Corrupt trailer: invalid padding bits value");
-        bytes.pop_back(); // Remove padding byte from encoded data
-
-        // Convert bytes to binary string (MSB-first per byte)
-        for (unsigned char byte : bytes) {
-            for (int bit = 7; bit >= 0; --bit) {
-                bitString.push_back(((byte >> bit) & 1) ? '1' : '0');
-            }
-        }
-
-        // Remove padding
-        if (paddingBits > 0 && !bitString.empty()) {
-            bitString = bitString.substr(0, bitString.size() - paddingBits);
-        }
-        if (bitString.empty()) throw std::runtime_error("Encoded bitstream is empty after removing padding");
+// Read and validate the file header at the start of a mapped file
+// Returns the offset of the first block
+uint64_t Decompressor::readFileHeader(
+    const uint8_t *file,
+    uint64_t fileSize,
+    const std::string &inputFile,
+    std::string &originalExt,
+    uint32_t &blockSize
+) {
+    try {
+        if (fileSize < RSK_FILE_HEADER_SIZE) throw std::runtime_error(inputFile + " is not an .rsk file");
+        uint32_t extLen = Decompressor::parseFileHeader(file, inputFile, blockSize);
+        if (fileSize - RSK_FILE_HEADER_SIZE < extLen) throw std::runtime_error("Failed reading extension data from " + inputFile);
+        originalExt.assign(reinterpret_cast<const char *>(file) + RSK_FILE_HEADER_SIZE, extLen);
+        return RSK_FILE_HEADER_SIZE + extLen;
     }
     catch(const std::exception &e) {
         throw std::runtime_error(
@@ -102,124 +94,654 @@ void Decompressor::readFromFileForDecompression(
     }
 }
 
-// Utility function to calculate the size of file
-size_t Decompressor::getFileSize(const std::string &filename) {
-    struct stat stat_buf;
-    int rc = stat(filename.c_str(), &stat_buf);
-    return rc == 0 ? stat_buf.st_size : 0;
+// Read the block index from the trailer of a mapped file and check that it describes
+// a contiguous run of blocks starting at blocksStart and ending at the end of blocks marker
+// Every block frame has to agree with its entry, which also picks up the block CRCs
+void Decompressor::readBlockIndex(
+    const uint8_t *file,
+    uint64_t fileSize,
+    uint64_t blocksStart,
+    uint32_t blockSize,
+    std::vector<BlockIndexEntry> &index
+) {
+    if (fileSize < blocksStart + 8 + RSK_FOOTER_SIZE) throw std::runtime_error("Truncated file: missing block index");
+
+    // Footer: index offset and magic
+    const uint8_t *footer = file + fileSize - RSK_FOOTER_SIZE;
+    if (std::string(reinterpret_cast<const char *>(footer) + 12, 4) != RSK_INDEX_MAGIC)
+        throw std::runtime_error("Corrupt trailer: block index footer not found");
+    uint64_t indexOffset = getU64(footer);
+    if (indexOffset < blocksStart + 4 || indexOffset > fileSize - RSK_FOOTER_SIZE - 4)
+        throw std::runtime_error("Corrupt trailer: block index offset out of bounds");
+
+    // Block count and entries
+    const uint8_t *table = file + indexOffset;
+    uint64_t tableSize = fileSize - RSK_FOOTER_SIZE - indexOffset;
+    uint32_t blockCount = getU32(table);
+    if (tableSize != 4 + static_cast<uint64_t>(blockCount) * BLOCK_INDEX_ENTRY_SIZE)
+        throw std::runtime_error("Corrupt trailer: block index size mismatch");
+
+    index.resize(blockCount);
+    uint64_t expectedOffset = blocksStart;
+    uint32_t crc = 0;
+    for (uint32_t i = 0; i < blockCount; i++) {
+        const uint8_t *p = table + 4 + static_cast<size_t>(i) * BLOCK_INDEX_ENTRY_SIZE;
+        BlockIndexEntry &entry = index[i];
+        entry.offset = getU64(p);
+        entry.compressedSize = getU32(p + 8);
+        entry.originalSize = getU32(p + 12);
+        if (entry.offset != expectedOffset || entry.compressedSize <= BLOCK_FRAME_HEADER_SIZE)
+            throw std::runtime_error("Corrupt trailer: block index entries are not contiguous");
+        if (entry.originalSize == 0 || entry.originalSize > blockSize)
+            throw std::runtime_error("Corrupt trailer: invalid block size in index");
+        expectedOffset += entry.compressedSize;
+        if (expectedOffset + 4 > indexOffset) throw std::runtime_error("Corrupt trailer: block index does not cover the file");
+
+        const uint8_t *frame = file + entry.offset;
+        if (getU32(frame) != entry.originalSize || getU32(frame + 4) != entry.compressedSize - BLOCK_FRAME_HEADER_SIZE)
+            throw std::runtime_error("Corrupt block: frame does not match block index");
+        entry.crc = getU32(frame + 8);
+        crc = Crc32c::combine(crc, entry.crc, entry.originalSize);
+    }
+    // The end of blocks marker sits between the last block and the index
+    if (expectedOffset + 4 != indexOffset) throw std::runtime_error("Corrupt trailer: block index does not cover the file");
+    if (getU32(footer + 8) != crc) throw std::runtime_error("Corrupt trailer: file CRC32C does not match the block CRCs");
+}
+
+// Locate the body of the block frame described by entry within a mapped file
+// readBlockIndex has already checked the frame header against the entry
+const uint8_t *Decompressor::locateBlock(const uint8_t *file, const BlockIndexEntry &entry) {
+    return file + entry.offset + BLOCK_FRAME_HEADER_SIZE;
 }
 
-// BWT Decoding
-std::string Decompressor::inverseBWT(std::string &encodedString, int idx) {
-    int n = encodedString.size();
-    std::vector<int> count(256, 0);
-    std::vector<int> rank(n);
+// Read the next block frame of a sequentially read input into entry and body
+// Returns false once the end of blocks marker is reached
+bool Decompressor::readNextBlock(
+    std::istream &in,
+    uint32_t blockSize,
+    uint64_t offset,
+    BlockIndexEntry &entry,
+    std::vector<uint8_t> &body
+) {
+    uint8_t frame[BLOCK_FRAME_HEADER_SIZE];
+    in.read(reinterpret_cast<char *>(frame), 4);
+    if (in.fail()) throw std::runtime_error("Truncated input: missing end of blocks marker");
+    entry.offset = offset;
+    entry.originalSize = getU32(frame);
+    if (entry.originalSize == 0) return false;
+    if (entry.originalSize > blockSize) throw std::runtime_error("Corrupt block: original size exceeds block size");
+
+    in.read(reinterpret_cast<char *>(frame), 8);
+    if (in.fail()) throw std::runtime_error("Truncated input: missing block body size");
+    uint32_t bodySize = getU32(frame);
+    entry.crc = getU32(frame + 4);
 
-    for(int i = 0; i < n; i++) {
-        rank[i] = count[(unsigned char)encodedString[i]]++;
+    // Codes are at most MAX_CODE_LENGTH bits per symbol, anything larger is corrupt
+    if (bodySize > static_cast<uint64_t>(entry.originalSize) * MAX_CODE_LENGTH / 8 + 1024)
+        throw std::runtime_error("Corrupt block: unreasonable body size");
+    entry.compressedSize = bodySize + BLOCK_FRAME_HEADER_SIZE;
+    body.resize(bodySize);
+    in.read(reinterpret_cast<char *>(body.data()), bodySize);
+    if (in.fail()) throw std::runtime_error("Truncated input: incomplete block body");
+    return true;
+}
+
+// Read the block index and footer that follow the end of blocks marker of a sequentially
+// read input and check them against the blocks that were actually read
+void Decompressor::verifyStreamTrailer(std::istream &in, const std::vector<BlockIndexEntry> &index, uint64_t indexOffset) {
+    uint8_t count[4];
+    in.read(reinterpret_cast<char *>(count), 4);
+    if (in.fail() || getU32(count) != index.size()) throw std::runtime_error("Corrupt trailer: block count mismatch");
+
+    std::vector<uint8_t> table(index.size() * BLOCK_INDEX_ENTRY_SIZE + RSK_FOOTER_SIZE);
+    in.read(reinterpret_cast<char *>(table.data()), table.size());
+    if (in.fail()) throw std::runtime_error("Truncated input: incomplete block index");
+    for (size_t i = 0; i < index.size(); i++) {
+        const uint8_t *p = table.data() + i * BLOCK_INDEX_ENTRY_SIZE;
+        if (getU64(p) != index[i].offset || getU32(p + 8) != index[i].compressedSize || getU32(p + 12) != index[i].originalSize)
+            throw std::runtime_error("Corrupt trailer: block index does not match the blocks");
+    }
+    const uint8_t *footer = table.data() + index.size() * BLOCK_INDEX_ENTRY_SIZE;
+    if (getU64(footer) != indexOffset || std::string(reinterpret_cast<const char *>(footer) + 12, 4) != RSK_INDEX_MAGIC)
+        throw std::runtime_error("Corrupt trailer: invalid footer");
+    uint32_t crc = 0;
+    for (const BlockIndexEntry &entry : index) crc = Crc32c::combine(crc, entry.crc, entry.originalSize);
+    if (getU32(footer + 8) != crc) throw std::runtime_error("Corrupt trailer: file CRC32C does not match the block CRCs");
+}
+
+// Read the block header and locate the encoded content
+// Code lengths from header data define the canonical Huffman codes
+void Decompressor::readBlockForDecompression(
+    const uint8_t *body,
+    size_t bodySize,
+    uint32_t originalSize,
+    BlockHeader &header
+) {
+    const uint8_t *p = body;
+    const uint8_t *end = body + bodySize;
+
+    // BWT index and block flags
+    if (end - p < 5) throw std::runtime_error("Corrupt block: truncated header");
+    header.lastCol = getU32(p);
+    header.flags = p[4];
+    p += 5;
+    if (header.flags & ~(BLOCK_FLAG_ZERO_RUNS | BLOCK_FLAG_NO_BWT | BLOCK_FLAG_STORED | BLOCK_FLAG_RANS))
+        throw std::runtime_error("Corrupt block: unknown block flags");
+    bool zeroRuns = header.flags & BLOCK_FLAG_ZERO_RUNS;
+
+    // Blocks without the BWT have no index; stored blocks have nothing else ahead of their bytes
+    if (header.flags & (BLOCK_FLAG_NO_BWT | BLOCK_FLAG_STORED)) {
+        if (header.lastCol != 0 || zeroRuns || (header.flags & BLOCK_FLAG_STORED && header.flags != BLOCK_FLAG_STORED))
+            throw std::runtime_error("Corrupt block: invalid block flags");
+    }
+    if (header.flags & BLOCK_FLAG_STORED) {
+        header.bwtCursors.clear();
+        header.codedSymbols = 0;
+        header.codeLengths.clear();
+        header.selectors.clear();
+        header.payloadOffset = p - body;
+        header.payloadBits = static_cast<uint64_t>(end - p) * 8;
+        return;
+    }
+
+    // Starting rows of the inverse BWT segments, the one ending the block is the BWT index
+    if (p == end) throw std::runtime_error("Corrupt block: truncated header");
+    size_t extraCursors = *p++;
+    if (extraCursors >= MAX_BWT_CURSORS || extraCursors >= originalSize) throw std::runtime_error("Corrupt block: invalid BWT cursor count");
+    if ((header.flags & BLOCK_FLAG_NO_BWT) && extraCursors != 0) throw std::runtime_error("Corrupt block: BWT cursors without a BWT");
+    if (static_cast<size_t>(end - p) < 4 * extraCursors) throw std::runtime_error("Corrupt block: truncated header");
+    header.bwtCursors.resize(extraCursors + 1);
+    for (size_t j = 0; j < extraCursors; j++, p += 4) header.bwtCursors[j] = getU32(p);
+    header.bwtCursors.back() = header.lastCol;
+
+    // Zero run coded blocks store how many symbols were coded, the alphabet grows by the run digits
+    header.codedSymbols = originalSize;
+    if (zeroRuns) {
+        if (end - p < 4) throw std::runtime_error("Corrupt block: truncated header");
+        header.codedSymbols = getU32(p);
+        p += 4;
+        // Zero runs never take more symbols than the bytes they stand for
+        if (header.codedSymbols == 0 || header.codedSymbols > originalSize) throw std::runtime_error("Corrupt header: invalid coded symbol count");
     }
 
-    std::vector<int> firstPos(256, 0);
-    int sum = 0;
-    for(int i = 0; i < 256; i++) {
-        firstPos[i] = sum;
-        sum += count[i];
+    // Read the code lengths or rANS frequencies of every table
+    if (p == end) throw std::runtime_error("Corrupt block: truncated header");
+    size_t tableCount = *p++;
+    if (tableCount < 1 || tableCount > MAX_HUFFMAN_TABLES) throw std::runtime_error("Corrupt block: invalid Huffman table count");
+    size_t alphabetSize = zeroRuns ? ZeroRunLength::ALPHABET_SIZE : ALPH_SIZE;
+    bool rans = header.flags & BLOCK_FLAG_RANS;
+    if (rans) {
+        header.codeLengths.clear();
+        header.frequencies.resize(tableCount);
+        p = Rans::readFrequencies(p, end, alphabetSize, header.frequencies);
+    } else {
+        header.frequencies.clear();
+        header.codeLengths.assign(tableCount, std::vector<uint8_t>(alphabetSize, 0));
+        p = huffmanTree::readCodeLengths(p, end, header.codeLengths);
     }
 
-    std::string result(n, ' ');
-    for(int i = n - 1; i >= 0; i--) {
-        char c = encodedString[idx];
-        result[i] = c;
-        idx = firstPos[(unsigned char)c] + rank[idx];
+    // Selectors: unary move to front positions, MSB first
+    size_t groupCount = (header.codedSymbols + HUFFMAN_GROUP_SIZE - 1) / HUFFMAN_GROUP_SIZE;
+    header.selectors.assign(groupCount, 0);
+    if (tableCount > 1) {
+        uint8_t recent[MAX_HUFFMAN_TABLES];
+        for (int t = 0; t < MAX_HUFFMAN_TABLES; t++) recent[t] = static_cast<uint8_t>(t);
+        uint64_t bit = 0;
+        uint64_t availableBits = static_cast<uint64_t>(end - p) * 8;
+        for (size_t group = 0; group < groupCount; group++) {
+            size_t position = 0;
+            for (;;) {
+                if (bit == availableBits) throw std::runtime_error("Corrupt block: truncated selectors");
+                bool one = (p[bit / 8] >> (7 - bit % 8)) & 1;
+                bit++;
+                if (!one) break;
+                if (++position == tableCount) throw std::runtime_error("Corrupt block: selector out of range");
+            }
+            uint8_t selector = recent[position];
+            for (size_t i = position; i > 0; i--) recent[i] = recent[i - 1];
+            recent[0] = selector;
+            header.selectors[group] = selector;
+        }
+        p += (bit + 7) / 8;
     }
 
-    return result;
+    // The rANS payload runs to the end of the body in whole words
+    if (rans) {
+        header.payloadOffset = p - body;
+        header.payloadBits = static_cast<uint64_t>(end - p) * 8;
+        return;
+    }
+
+    // Bits of every stream; each stream is padded to a whole byte and they fill the rest of the body
+    if (static_cast<size_t>(end - p) < 4 * HUFFMAN_STREAMS) throw std::runtime_error("Corrupt block: truncated Huffman stream sizes");
+    uint64_t streamBytes = 0;
+    header.payloadBits = 0;
+    for (size_t k = 0; k < HUFFMAN_STREAMS; k++, p += 4) {
+        header.streamBits[k] = getU32(p);
+        header.payloadBits += header.streamBits[k];
+        streamBytes += (header.streamBits[k] + 7) / 8;
+    }
+    header.payloadOffset = p - body;
+    if (streamBytes != static_cast<uint64_t>(end - p)) throw std::runtime_error("Corrupt block: Huffman stream sizes do not match the payload");
+}
+
+// Decode the Huffman or rANS coded symbols of a block into out
+// A code with a single symbol has no payload, the symbol is simply repeated
+template <typename Symbol>
+void Decompressor::decodeSymbols(const uint8_t *body, size_t bodySize, const BlockHeader &header, Symbol *out) {
+    if (header.flags & BLOCK_FLAG_RANS) {
+        Rans::decode(body + header.payloadOffset, bodySize - header.payloadOffset, header.selectors.data(),
+                     HUFFMAN_GROUP_SIZE, header.frequencies, out, header.codedSymbols);
+        return;
+    }
+    const std::vector<uint8_t> &first = header.codeLengths.front();
+    size_t symbolCount = first.size() - std::count(first.begin(), first.end(), 0);
+    if (symbolCount == 1) {
+        if (header.payloadBits != 0) throw std::runtime_error("Corrupt block: unexpected payload for a single symbol block");
+        Symbol symbol = static_cast<Symbol>(std::find_if(first.begin(), first.end(), [](uint8_t l) { return l != 0; }) - first.begin());
+        std::fill(out, out + header.codedSymbols, symbol);
+        return;
+    }
+
+    // Decode the packed streams through lookup tables built from the canonical code lengths
+    std::vector<HuffmanDecoder> decoders;
+    for (const std::vector<uint8_t> &codeLengths : header.codeLengths) decoders.emplace_back(codeLengths);
+    HuffmanDecoder::decodeStreams(decoders, header.selectors.data(), HUFFMAN_GROUP_SIZE, body + header.payloadOffset,
+                                  header.streamBits, out, header.codedSymbols);
 }
 
+template void Decompressor::decodeSymbols<uint8_t>(const uint8_t *, size_t, const BlockHeader &, uint8_t *);
+template void Decompressor::decodeSymbols<uint16_t>(const uint8_t *, size_t, const BlockHeader &, uint16_t *);
+
+// Follows the LF mapping of every segment of the block at once, writing each segment back to front
+// A link holds the next row above the byte of the current row, so every step is one dependent load;
+// the chains are independent, so their cache misses overlap
+template <typename Link>
+static void followBWTChains(const uint8_t *lastCol, size_t n, const std::vector<size_t> &cursors, uint8_t *out,
+                            std::vector<Link> &links) {
+    size_t next[256] = {0};
+    for (size_t i = 0; i < n; i++) next[lastCol[i]]++;
+    size_t sum = 0;
+    for (int c = 0; c < 256; c++) {
+        size_t count = next[c];
+        next[c] = sum;
+        sum += count;
+    }
+    links.resize(n);
+    for (size_t i = 0; i < n; i++) links[i] = static_cast<Link>(next[lastCol[i]]++) << 8 | lastCol[i];
+
+    // Segment j covers [j * n / segments, (j + 1) * n / segments), lengths differ by at most one
+    size_t segments = cursors.size();
+    size_t row[MAX_BWT_CURSORS];
+    size_t begin[MAX_BWT_CURSORS];
+    size_t pos[MAX_BWT_CURSORS];
+    size_t shortest = n;
+    for (size_t j = 0; j < segments; j++) {
+        begin[j] = static_cast<uint64_t>(j) * n / segments;
+        pos[j] = static_cast<uint64_t>(j + 1) * n / segments;
+        row[j] = cursors[j];
+        if (row[j] >= n) throw std::runtime_error("Corrupt header: BWT index out of bounds");
+        shortest = std::min(shortest, pos[j] - begin[j]);
+    }
+    const Link *link = links.data();
+    for (size_t step = 0; step < shortest; step++) {
+        for (size_t j = 0; j < segments; j++) {
+            Link l = link[row[j]];
+            out[--pos[j]] = static_cast<uint8_t>(l);
+            row[j] = static_cast<size_t>(l >> 8);
+        }
+    }
+    for (size_t j = 0; j < segments; j++) {
+        while (pos[j] > begin[j]) {
+            Link l = link[row[j]];
+            out[--pos[j]] = static_cast<uint8_t>(l);
+            row[j] = static_cast<size_t>(l >> 8);
+        }
+    }
+}
+
+// BWT Decoding
+// The original text is rebuilt back to front straight into out
+void Decompressor::inverseBWT(const std::string &encodedString, size_t idx, uint8_t *out) {
+    std::vector<uint32_t> links;
+    Decompressor::inverseBWT(reinterpret_cast<const uint8_t *>(encodedString.data()), encodedString.size(),
+                             std::vector<size_t>{idx}, out, links);
+}
+
+// Same, starting one chain from each of cursors with the links in a caller owned buffer
+// Rows up to 2^24 pack with their byte into 32 bits, larger blocks take 64-bit links
+void Decompressor::inverseBWT(const uint8_t *lastCol, size_t n, const std::vector<size_t> &cursors, uint8_t *out,
+                              std::vector<uint32_t> &links) {
+    if (n == 0) return;
+    if (cursors.empty() || cursors.size() > MAX_BWT_CURSORS || cursors.size() > n)
+        throw std::runtime_error("Corrupt header: invalid BWT cursor count");
+    if (n <= (static_cast<size_t>(1) << 24)) {
+        followBWTChains(lastCol, n, cursors, out, links);
+        return;
+    }
+    std::vector<uint64_t> wideLinks;
+    followBWTChains(lastCol, n, cursors, out, wideLinks);
+}
+
+// Move to Front Decoding
 std::string Decompressor::MTFDecoding(const std::vector<uint8_t>& encodedInput) {
-    std::list<char> symbols;
-    for(int i = 0; i < ALPH_SIZE; i++)
-        symbols.push_back((char)i);
-
-    std::string output;
-    output.reserve(encodedInput.size()); // Pre-allocate
-
-    for(uint8_t idx : encodedInput) {
-        // Find the character at position 'idx'
-        auto it = symbols.begin();
-        std::advance(it, idx);  // Move iterator to position idx
-        
-        char c = *it;
-        output.push_back(c);
-        
-        // Move this character to front
-        symbols.erase(it);
-        symbols.push_front(c);
-    }
-    
+    std::string output(encodedInput.size(), '\0');
+    MoveToFront::decode(encodedInput.data(), encodedInput.size(), reinterpret_cast<uint8_t *>(&output[0]));
     return output;
 }
 
-// Main Decompression utility
-std::pair<size_t, size_t> Decompressor::Decompress(const std::string &inputFile) {
-    std::map<uint8_t, size_t> frequencyTable; 
-    uint32_t originalSize;                  
-    std::string bitString;
-    std::string originalExt; 
-    size_t lastCol;                           
-    size_t inputFileSize = Decompressor::getFileSize(inputFile); 
+// Decode a single block: Huffman, zero runs, inverse MTF and inverse BWT
+// The originalSize decoded bytes are written to out and checked against the block's CRC
+void Decompressor::decompressBlock(const uint8_t *body, size_t bodySize, uint32_t originalSize, uint32_t crc, uint8_t *out,
+                                   PipelineStats *stats) {
+    Scratch scratch;
+    Decompressor::decompressBlock(body, bodySize, originalSize, crc, out, scratch, stats);
+}
 
-    // Read the input file for decompression
-    Decompressor::readFromFileForDecompression(inputFile, originalExt, frequencyTable, originalSize, bitString, lastCol);
+// Same, with the buffers sized by the block in scratch so a caller that keeps it reuses them across blocks
+void Decompressor::decompressBlock(const uint8_t *body, size_t bodySize, uint32_t originalSize, uint32_t crc, uint8_t *out,
+                                   Scratch &scratch, PipelineStats *stats) {
+    BlockHeader &header = scratch.header;
+    PipelineStats::measure(stats, Stage::HeaderParse, [&]() {
+        Decompressor::readBlockForDecompression(body, bodySize, originalSize, header);
+    });
 
     // Validate header values against simple invariants
-    if (frequencyTable.empty()) throw std::runtime_error("Corrupt header: empty frequency table");
-    size_t sumFreq = 0;
-    for (const auto &p : frequencyTable) sumFreq += p.second;
-    if (sumFreq != static_cast<size_t>(originalSize)) throw std::runtime_error("Corrupt header: frequency sum does not match original size");
-    if (lastCol >= static_cast<size_t>(originalSize)) throw std::runtime_error("Corrupt header: BWT index out of bounds");
-
-    
-    std::vector<uint8_t> decodedMTF;
-    if(frequencyTable.size() == 1) {
-        // Handle single unique character case
-        // The entire file is just this one character repeated
-        decodedMTF = std::vector<uint8_t>(originalSize, frequencyTable.begin()->first);
-    }
-    else {
-        // Build the huffman tree from extracted header data
-        std::shared_ptr<minHeapNode> root = huffmanTree::buildHuffmanTree(frequencyTable);
-        if (!root) throw std::runtime_error("Failed to build Huffman tree");
-        
-        // Decode file and get string of original content
-        decodedMTF = huffmanTree::decodeHuffmanTree(root, bitString, originalSize);
-    }
-
-    if (decodedMTF.size() != static_cast<size_t>(originalSize)) throw std::runtime_error("Decoded MTF size mismatch; data may be corrupted");
-
-    std::string mtfDecoded = Decompressor::MTFDecoding(decodedMTF);
-    if (mtfDecoded.size() != static_cast<size_t>(originalSize)) throw std::runtime_error("MTF decoding produced unexpected size");
-    std::string decodedString = Decompressor::inverseBWT(mtfDecoded, static_cast<int>(lastCol));
-    
+    if (header.lastCol >= static_cast<size_t>(originalSize)) throw std::runtime_error("Corrupt header: BWT index out of bounds");
+
+    // Stored and Huffman only blocks hold the original bytes
+    if (header.flags & (BLOCK_FLAG_STORED | BLOCK_FLAG_NO_BWT)) {
+        if (header.flags & BLOCK_FLAG_STORED) {
+            if (bodySize - header.payloadOffset != originalSize) throw std::runtime_error("Corrupt block: stored size does not match");
+            std::memcpy(out, body + header.payloadOffset, originalSize);
+        } else {
+            PipelineStats::measure(stats, Stage::HuffmanDecode, [&]() {
+                Decompressor::decodeSymbols(body, bodySize, header, out);
+            });
+        }
+        uint32_t actual = PipelineStats::measure(stats, Stage::Checksum, [&]() { return Crc32c::compute(out, originalSize); });
+        if (actual != crc) throw std::runtime_error("Corrupt block: CRC32C mismatch");
+        if (stats) {
+            bool stored = header.flags & BLOCK_FLAG_STORED;
+            if (!stored) stats->addPayload(header.codedSymbols, header.payloadBits, header.flags & BLOCK_FLAG_RANS,
+                                           std::max(header.codeLengths.size(), header.frequencies.size()));
+            stats->countData(out, originalSize);
+            stats->countBlock(stored ? BlockMode::Stored : BlockMode::HuffmanOnly, originalSize);
+        }
+        return;
+    }
+
+    std::vector<uint8_t> &decodedMTF = scratch.mtf;
+    decodedMTF.resize(originalSize);
+    if (header.flags & BLOCK_FLAG_ZERO_RUNS) {
+        std::vector<uint16_t> &symbols = scratch.symbols;
+        symbols.resize(header.codedSymbols);
+        PipelineStats::measure(stats, Stage::HuffmanDecode, [&]() {
+            Decompressor::decodeSymbols(body, bodySize, header, symbols.data());
+        });
+        PipelineStats::measure(stats, Stage::InverseZeroRuns, [&]() {
+            ZeroRunLength::decode(symbols.data(), symbols.size(), decodedMTF.data(), originalSize);
+        });
+    } else {
+        PipelineStats::measure(stats, Stage::HuffmanDecode, [&]() {
+            Decompressor::decodeSymbols(body, bodySize, header, decodedMTF.data());
+        });
+    }
+
+    std::vector<uint8_t> &lastColumn = scratch.lastColumn;
+    PipelineStats::measure(stats, Stage::InverseMTF, [&]() {
+        lastColumn.resize(originalSize);
+        MoveToFront::decode(decodedMTF.data(), originalSize, lastColumn.data());
+    });
+    PipelineStats::measure(stats, Stage::InverseBWT, [&]() {
+        Decompressor::inverseBWT(lastColumn.data(), originalSize, header.bwtCursors, out, scratch.links);
+    });
+    uint32_t actual = PipelineStats::measure(stats, Stage::Checksum, [&]() { return Crc32c::compute(out, originalSize); });
+    if (actual != crc) throw std::runtime_error("Corrupt block: CRC32C mismatch");
+
+    if (stats) {
+        stats->addPayload(header.codedSymbols, header.payloadBits, header.flags & BLOCK_FLAG_RANS,
+                          std::max(header.codeLengths.size(), header.frequencies.size()));
+        stats->countMTF(decodedMTF.data(), originalSize);
+        stats->countData(out, originalSize);
+        stats->countBlock(BlockMode::Full, originalSize);
+    }
+}
+
+// A block on its way through the decompression pipeline
+struct DecodeJob {
+    BlockIndexEntry entry;
+    std::vector<uint8_t> body;
+    std::vector<uint8_t> decoded;
+};
+
+// Decode the blocks handed out by nextBlock through a BlockPipeline: a reader thread reads them,
+// the workers decode them and this thread writes them to out in order
+// Buffers are recycled and bounded in number, so memory stays proportional to the worker count
+// Without out the blocks are only decoded and checked
+// Returns the number of bytes decoded
+uint64_t Decompressor::decodeBlocks(
+    const std::function<bool(BlockIndexEntry &, std::vector<uint8_t> &)> &nextBlock,
+    std::ostream *out,
+    size_t threads,
+    PipelineStats *stats
+) {
+    uint64_t written = 0;
+    BlockPipeline<DecodeJob>::run(
+        [&](DecodeJob &job) {
+            return PipelineStats::measure(stats, Stage::Read, [&]() { return nextBlock(job.entry, job.body); });
+        },
+        [stats](DecodeJob &job) {
+            thread_local Decompressor::Scratch scratch;
+            job.decoded.resize(job.entry.originalSize);
+            Decompressor::decompressBlock(job.body.data(), job.body.size(), job.entry.originalSize, job.entry.crc,
+                                          job.decoded.data(), scratch, stats);
+        },
+        [&](DecodeJob &job) {
+            written += job.decoded.size();
+            if (!out) return;
+            PipelineStats::Timer timer(stats, Stage::Write);
+            out->write(reinterpret_cast<const char *>(job.decoded.data()), job.decoded.size());
+            if (!*out) throw std::runtime_error("Failed writing decompressed output");
+        },
+        threads);
+    if (out) PipelineStats::measure(stats, Stage::Write, [&]() { out->flush(); });
+    return written;
+}
+
+// A block of a mapped input on its way through the decompression pipeline
+struct MappedDecodeJob {
+    BlockIndexEntry entry;
+    const uint8_t *body;
+    uint8_t *target;               // Place of the block in the mapped output, null when only checking
+    std::vector<uint8_t> discard;  // Receives the block when there is no output
+};
+
+// Decode the blocks of a mapped .rsk file through a BlockPipeline, each straight from the mapping
+// into its place in out; without out the blocks are only decoded and checked
+// The reader stage only locates the blocks and there is nothing left to write, but the pipeline
+// still bounds the blocks in flight and keeps the workers' scratch the same as for streams
+void Decompressor::decodeMappedBlocks(
+    const uint8_t *file,
+    const std::vector<BlockIndexEntry> &index,
+    uint8_t *out,
+    size_t threads,
+    PipelineStats *stats
+) {
+    size_t next = 0;
+    uint64_t outputOffset = 0;
+    BlockPipeline<MappedDecodeJob>::run(
+        [&](MappedDecodeJob &job) {
+            if (next == index.size()) return false;
+            job.entry = index[next++];
+            job.body = Decompressor::locateBlock(file, job.entry);
+            job.target = out ? out + outputOffset : nullptr;
+            outputOffset += job.entry.originalSize;
+            return true;
+        },
+        [stats](MappedDecodeJob &job) {
+            thread_local Decompressor::Scratch scratch;
+            uint8_t *blockOut = job.target;
+            if (!blockOut) {
+                job.discard.resize(job.entry.originalSize);
+                blockOut = job.discard.data();
+            }
+            Decompressor::decompressBlock(job.body, job.entry.compressedSize - BLOCK_FRAME_HEADER_SIZE,
+                                          job.entry.originalSize, job.entry.crc, blockOut, scratch, stats);
+        },
+        [](MappedDecodeJob &) {},
+        std::min(threads ? threads : ThreadPool::defaultThreadCount(), std::max<size_t>(index.size(), 1)));
+}
+
+// Read the container header and block index of a mapped .rsk file
+// Blocks are paged in by the workers, so the read stage only covers the header and the index
+void Decompressor::readMappedContainer(
+    const uint8_t *file,
+    uint64_t fileSize,
+    const std::string &inputFile,
+    std::string &originalExt,
+    std::vector<BlockIndexEntry> &index,
+    PipelineStats *stats
+) {
+    PipelineStats::measure(stats, Stage::Read, [&]() {
+        uint32_t blockSize;
+        uint64_t blocksStart = Decompressor::readFileHeader(file, fileSize, inputFile, originalExt, blockSize);
+        try {
+            Decompressor::readBlockIndex(file, fileSize, blocksStart, blockSize, index);
+        }
+        catch(const std::exception &e) {
+            throw std::runtime_error(std::string("Failed while reading input file: ") + e.what());
+        }
+    });
+}
+
+// Main Decompression utility
+// The input is mapped and the output is created at its final size and mapped as well
+// Every block is decoded by a worker straight from the input mapping into its place in the output
+std::pair<size_t, size_t> Decompressor::Decompress(const std::string &inputFile, size_t threads, PipelineStats *stats) {
+    std::string originalExt;
+    std::vector<BlockIndexEntry> index;
+    MappedFile inFile(inputFile);
+    Decompressor::readMappedContainer(inFile.data(), inFile.size(), inputFile, originalExt, index, stats);
+    uint64_t outputSize = 0;
+    for (const BlockIndexEntry &entry : index) outputSize += entry.originalSize;
+
     // Create output filename with original extension
     size_t dotPos = inputFile.rfind('.');
     std::string baseFilename = (dotPos != std::string::npos) ? inputFile.substr(0, dotPos) : inputFile;
     std::string outputFile = "decompressed_" + baseFilename + originalExt;
 
-    // Open new output file
-    std::ofstream outFile(outputFile, std::ios::binary);
-    outFile.exceptions(std::ofstream::failbit | std::ofstream::badbit);
-    if (!outFile) throw std::runtime_error("Failed to open the output file for decompression\n");
-    
-    // Write decoded data to output file
+    MappedOutputFile outFile(outputFile, outputSize);
+    Decompressor::decodeMappedBlocks(inFile.data(), index, outFile.data(), threads, stats);
+    // Unmapping writes back whatever the kernel has not flushed yet
+    PipelineStats::measure(stats, Stage::Write, [&]() { outFile.close(); });
+
+    std::cout << "File has been successfully decompressed and saved as " + outputFile << std::endl;
+    return std::make_pair(static_cast<size_t>(inFile.size()), static_cast<size_t>(outputSize));
+}
+
+// Decode only the blocks covering original bytes [offset, offset + length), found through the block
+// index, and return that slice in out; the covering blocks are decoded in place and the slice is
+// moved to the front. A range running past the end of the data is cut short there
+std::pair<size_t, size_t> Decompressor::ReadRange(const std::string &inputFile, uint64_t offset, uint64_t length,
+                                                  std::vector<uint8_t> &out, size_t threads, PipelineStats *stats) {
+    std::string originalExt;
+    std::vector<BlockIndexEntry> index;
+    MappedFile inFile(inputFile);
+    Decompressor::readMappedContainer(inFile.data(), inFile.size(), inputFile, originalExt, index, stats);
+
+    // blockStart[b] is where block b starts in the original data
+    std::vector<uint64_t> blockStart(index.size() + 1, 0);
+    for (size_t b = 0; b < index.size(); b++) blockStart[b + 1] = blockStart[b] + index[b].originalSize;
+    uint64_t dataSize = blockStart.back();
+    if (offset > dataSize)
+        throw std::runtime_error("Range starts past the end of the data (" + std::to_string(dataSize) + " bytes)");
+    length = std::min(length, dataSize - offset);
+    out.clear();
+    if (length == 0) return std::make_pair(static_cast<size_t>(0), static_cast<size_t>(0));
+
+    size_t first = std::upper_bound(blockStart.begin(), blockStart.end(), offset) - blockStart.begin() - 1;
+    size_t last = std::upper_bound(blockStart.begin(), blockStart.end(), offset + length - 1) - blockStart.begin() - 1;
+    std::vector<BlockIndexEntry> covering(index.begin() + first, index.begin() + last + 1);
+    uint64_t coveringSize = 0;
+    for (const BlockIndexEntry &entry : covering) coveringSize += entry.compressedSize;
+    out.resize(blockStart[last + 1] - blockStart[first]);
+    Decompressor::decodeMappedBlocks(inFile.data(), covering, out.data(), threads, stats);
+
+    size_t skip = static_cast<size_t>(offset - blockStart[first]);
+    if (skip) std::memmove(out.data(), out.data() + skip, static_cast<size_t>(length));
+    out.resize(static_cast<size_t>(length));
+    return std::make_pair(static_cast<size_t>(coveringSize), static_cast<size_t>(blockStart[last + 1] - blockStart[first]));
+}
+
+// Decompress an in-memory .rsk image into out, one block after the other on the calling thread
+// The image is checked the same way as a mapped file
+void Decompressor::DecompressBuffer(const uint8_t *data, size_t size, Scratch &scratch, std::vector<uint8_t> &out) {
+    std::string originalExt;
+    uint32_t blockSize;
+    std::vector<BlockIndexEntry> &index = scratch.index;
+    uint64_t blocksStart = Decompressor::readFileHeader(data, size, "buffer", originalExt, blockSize);
     try {
-        outFile.write(decodedString.c_str(), decodedString.size());
-        outFile.close(); 
-    } catch(const std::exception &e) {
-        throw std::runtime_error(std::string("Failed writing decompressed output file: ") + e.what());
+        Decompressor::readBlockIndex(data, size, blocksStart, blockSize, index);
     }
-    size_t outputFileSize = Decompressor::getFileSize(outputFile); 
-    std::cout << "File has been successfully decompressed and saved as " + outputFile << std::endl;
+    catch(const std::exception &e) {
+        throw std::runtime_error(std::string("Failed while reading input buffer: ") + e.what());
+    }
+
+    uint64_t outputSize = 0;
+    for (const BlockIndexEntry &entry : index) outputSize += entry.originalSize;
+    out.resize(outputSize);
+
+    uint64_t outputOffset = 0;
+    for (const BlockIndexEntry &entry : index) {
+        const uint8_t *body = Decompressor::locateBlock(data, entry);
+        Decompressor::decompressBlock(body, entry.compressedSize - BLOCK_FRAME_HEADER_SIZE, entry.originalSize, entry.crc,
+                                      out.data() + outputOffset, scratch);
+        outputOffset += entry.originalSize;
+    }
+}
+
+// Decode a sequentially read input, such as a pipe, without seeking
+// Blocks are decoded as they arrive; the block index at the end is checked against them
+std::pair<size_t, size_t> Decompressor::decompressStream(std::istream &in, std::ostream *out, size_t threads, PipelineStats *stats) {
+    std::string originalExt;
+    uint32_t blockSize;
+    PipelineStats::measure(stats, Stage::Read, [&]() { Decompressor::readFileHeader(in, "input", originalExt, blockSize); });
+
+    std::vector<BlockIndexEntry> index;
+    uint64_t offset = RSK_FILE_HEADER_SIZE + originalExt.size();
+    auto nextBlock = [&](BlockIndexEntry &entry, std::vector<uint8_t> &body) {
+        if (!Decompressor::readNextBlock(in, blockSize, offset, entry, body)) return false;
+        index.push_back(entry);
+        offset += entry.compressedSize;
+        return true;
+    };
+    uint64_t written = Decompressor::decodeBlocks(nextBlock, out, threads, stats);
+
+    // The end of blocks marker was consumed by the last readNextBlock call
+    PipelineStats::measure(stats, Stage::Read, [&]() { Decompressor::verifyStreamTrailer(in, index, offset + 4); });
+    return std::make_pair(static_cast<size_t>(offset + 4 + 4 + index.size() * BLOCK_INDEX_ENTRY_SIZE + RSK_FOOTER_SIZE),
+                          static_cast<size_t>(written));
+}
+
+std::pair<size_t, size_t> Decompressor::DecompressStream(std::istream &in, std::ostream &out, size_t threads, PipelineStats *stats) {
+    return Decompressor::decompressStream(in, &out, threads, stats);
+}
+
+// Verify a compressed file: every block is decoded and checked against its CRC32C, nothing is written
+// The whole-file CRC in the footer has already been checked against the block CRCs by readBlockIndex
+std::pair<size_t, size_t> Decompressor::Test(const std::string &inputFile, size_t threads, PipelineStats *stats) {
+    std::string originalExt;
+    std::vector<BlockIndexEntry> index;
+    MappedFile inFile(inputFile);
+    Decompressor::readMappedContainer(inFile.data(), inFile.size(), inputFile, originalExt, index, stats);
+    uint64_t originalSize = 0;
+    for (const BlockIndexEntry &entry : index) originalSize += entry.originalSize;
+
+    Decompressor::decodeMappedBlocks(inFile.data(), index, nullptr, threads, stats);
+    return std::make_pair(static_cast<size_t>(inFile.size()), static_cast<size_t>(originalSize));
+}
 
-    return std::make_pair(inputFileSize, outputFileSize);
+std::pair<size_t, size_t> Decompressor::TestStream(std::istream &in, size_t threads, PipelineStats *stats) {
+    return Decompressor::decompressStream(in, nullptr, threads, stats);
 }
@@ -4,21 +4,133 @@
 #include <map>
 #include <utility>
 #include <vector>
+#include <fstream>
+#include <functional>
+#include "rskFormat.h"
+
+class PipelineStats;
 
 class Decompressor {
-    static void readFromFileForDecompression(
-        const std::string &inputFile, 
-        std::string &originalExt, 
-        std::map<uint8_t, size_t> &frequencyTable, 
-        uint32_t &originalSize, 
-        std::string &bitString, 
-        size_t &lastCol
-    );
-    static size_t getFileSize(const std::string &filename);
-    static std::string inverseBWT(std::string &encodedString, int idx);
-    static std::string MTFDecoding(const std::vector<uint8_t>& encodedInput);
+    static uint32_t parseFileHeader(const uint8_t *header, const std::string &inputFile, uint32_t &blockSize);
+    static void readFileHeader(
+        std::istream &inFile,
+        const std::string &inputFile,
+        std::string &originalExt,
+        uint32_t &blockSize
+    );
+    static uint64_t readFileHeader(
+        const uint8_t *file,
+        uint64_t fileSize,
+        const std::string &inputFile,
+        std::string &originalExt,
+        uint32_t &blockSize
+    );
+    static bool readNextBlock(
+        std::istream &in,
+        uint32_t blockSize,
+        uint64_t offset,
+        BlockIndexEntry &entry,
+        std::vector<uint8_t> &body
+    );
+    static void verifyStreamTrailer(std::istream &in, const std::vector<BlockIndexEntry> &index, uint64_t indexOffset);
+    static uint64_t decodeBlocks(
+        const std::function<bool(BlockIndexEntry &, std::vector<uint8_t> &)> &nextBlock,
+        std::ostream *out,
+        size_t threads,
+        PipelineStats *stats
+    );
+    static void decodeMappedBlocks(
+        const uint8_t *file,
+        const std::vector<BlockIndexEntry> &index,
+        uint8_t *out,
+        size_t threads,
+        PipelineStats *stats
+    );
+    static std::pair<size_t, size_t> decompressStream(std::istream &in, std::ostream *out, size_t threads, PipelineStats *stats);
+    static void readMappedContainer(
+        const uint8_t *file,
+        uint64_t fileSize,
+        const std::string &inputFile,
+        std::string &originalExt,
+        std::vector<BlockIndexEntry> &index,
+        PipelineStats *stats
+    );
 public:
-    static std::pair<size_t, size_t> Decompress(const std::string &inputFile);
+    // Container pieces shared with the archive reader
+    // readBlockIndex takes fileSize as the end of the .rsk footer, which is the end of the file outside archives
+    static void readBlockIndex(
+        const uint8_t *file,
+        uint64_t fileSize,
+        uint64_t blocksStart,
+        uint32_t blockSize,
+        std::vector<BlockIndexEntry> &index
+    );
+    static const uint8_t *locateBlock(const uint8_t *file, const BlockIndexEntry &entry);
+
+    // Everything a block body stores ahead of the Huffman coded payload
+    struct BlockHeader {
+        size_t lastCol;                                 // BWT index
+        std::vector<size_t> bwtCursors;                 // Starting rows of the inverse BWT segments, lastCol last
+        uint8_t flags;
+        size_t codedSymbols;                            // Symbols in the Huffman coded payload
+        std::vector<std::vector<uint8_t>> codeLengths;  // Code lengths of every Huffman table
+        std::vector<std::vector<uint16_t>> frequencies; // rANS frequencies of every table instead, with BLOCK_FLAG_RANS
+        std::vector<uint8_t> selectors;                 // Table of every group of HUFFMAN_GROUP_SIZE symbols
+        size_t payloadOffset;
+        uint64_t payloadBits;                           // Coded bits of all streams, padding excluded
+        uint64_t streamBits[HUFFMAN_STREAMS];           // Coded bits of every Huffman stream
+    };
+
+    // Intermediate buffers of the block pipeline
+    // Kept between blocks by callers that decode many of them on one thread, so the buffers sized by
+    // the block are reused; Huffman decoders and rANS slot tables are still built per block
+    struct Scratch {
+        BlockHeader header;
+        std::vector<uint16_t> symbols;
+        std::vector<uint8_t> mtf;
+        std::vector<uint8_t> lastColumn;
+        std::vector<uint32_t> links;
+        std::vector<BlockIndexEntry> index;
+    };
+
+    // Pipeline stages of one block, public so they can be measured one at a time
+    static void readBlockForDecompression(
+        const uint8_t *body,
+        size_t bodySize,
+        uint32_t originalSize,
+        BlockHeader &header
+    );
+    template <typename Symbol>
+    static void decodeSymbols(const uint8_t *body, size_t bodySize, const BlockHeader &header, Symbol *out);
+    // crc is the CRC32C of the original bytes, a mismatch throws
+    static void decompressBlock(const uint8_t *body, size_t bodySize, uint32_t originalSize, uint32_t crc, uint8_t *out,
+                                PipelineStats *stats = nullptr);
+    static void decompressBlock(const uint8_t *body, size_t bodySize, uint32_t originalSize, uint32_t crc, uint8_t *out,
+                                Scratch &scratch, PipelineStats *stats = nullptr);
+    static void inverseBWT(const std::string &encodedString, size_t idx, uint8_t *out);
+    static void inverseBWT(const uint8_t *lastCol, size_t n, const std::vector<size_t> &cursors, uint8_t *out,
+                           std::vector<uint32_t> &links);
+    static std::string MTFDecoding(const std::vector<uint8_t>& encodedInput);
+
+    // stats, when given, collects stage timings and coding statistics of the run
+    static std::pair<size_t, size_t> Decompress(const std::string &inputFile, size_t threads = 0,
+                                                PipelineStats *stats = nullptr);
+    static std::pair<size_t, size_t> DecompressStream(std::istream &in, std::ostream &out, size_t threads = 0,
+                                                      PipelineStats *stats = nullptr);
+
+    // Original bytes [offset, offset + length) into out, decoding only the blocks they lie in
+    // The slice ends early at the end of the data; an offset past the end throws
+    // Returns the compressed and original sizes of the blocks decoded for it, the slice itself is out.size()
+    static std::pair<size_t, size_t> ReadRange(const std::string &inputFile, uint64_t offset, uint64_t length,
+                                               std::vector<uint8_t> &out, size_t threads = 0,
+                                               PipelineStats *stats = nullptr);
+
+    // Decode everything and check the block and file CRCs without writing any output
+    static std::pair<size_t, size_t> Test(const std::string &inputFile, size_t threads = 0, PipelineStats *stats = nullptr);
+    static std::pair<size_t, size_t> TestStream(std::istream &in, size_t threads = 0, PipelineStats *stats = nullptr);
+
+    // Decompress the .rsk image data[0..size) into out on the calling thread, out is replaced
+    static void DecompressBuffer(const uint8_t *data, size_t size, Scratch &scratch, std::vector<uint8_t> &out);
 };
 
 #endif // DECOMPRESSOR_H
\ No newline at end of file
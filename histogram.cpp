@@ -0,0 +1,106 @@
+#include "histogram.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+const size_t Histogram::MAX_ALPHABET;
+
+// Value i of every run of eight goes to bank i
+static const int BANKS = 8;
+// Bank entries are 32 bits, so long inputs are counted a chunk at a time
+static const size_t CHUNK_SIZE = size_t(1) << 31;
+
+typedef uint32_t Banks[BANKS][Histogram::MAX_ALPHABET];
+
+// Adds the first width entries of all banks to counts, four entries per SIMD add
+static void mergeBanks(const Banks &banks, size_t width, size_t *counts) {
+    size_t i = 0;
+#if defined(__SSE2__)
+    for (; i + 4 <= width; i += 4) {
+        __m128i sum = _mm_loadu_si128(reinterpret_cast<const __m128i *>(banks[0] + i));
+        for (int b = 1; b < BANKS; b++)
+            sum = _mm_add_epi32(sum, _mm_loadu_si128(reinterpret_cast<const __m128i *>(banks[b] + i)));
+        uint32_t lanes[4];
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(lanes), sum);
+        for (int j = 0; j < 4; j++) counts[i + j] += lanes[j];
+    }
+#endif
+    for (; i < width; i++) {
+        uint32_t sum = 0;
+        for (int b = 0; b < BANKS; b++) sum += banks[b][i];
+        counts[i] += sum;
+    }
+}
+
+void Histogram::countBytes(const uint8_t *data, size_t size, size_t *counts) {
+    Banks banks;
+    while (size > 0) {
+        size_t chunk = std::min(size, CHUNK_SIZE);
+        for (uint32_t *bank : banks) std::memset(bank, 0, 256 * sizeof(uint32_t));
+
+        // One 8-byte load per eight values, byte i of the word goes to bank i
+        size_t i = 0;
+        for (; i + 8 <= chunk; i += 8) {
+            uint64_t word;
+            std::memcpy(&word, data + i, 8);
+            banks[0][word & 0xFF]++;
+            banks[1][(word >> 8) & 0xFF]++;
+            banks[2][(word >> 16) & 0xFF]++;
+            banks[3][(word >> 24) & 0xFF]++;
+            banks[4][(word >> 32) & 0xFF]++;
+            banks[5][(word >> 40) & 0xFF]++;
+            banks[6][(word >> 48) & 0xFF]++;
+            banks[7][word >> 56]++;
+        }
+        for (; i < chunk; i++) banks[0][data[i]]++;
+
+        mergeBanks(banks, 256, counts);
+        data += chunk;
+        size -= chunk;
+    }
+}
+
+void Histogram::countSymbols(const uint16_t *symbols, size_t count, size_t alphabetSize, size_t *counts) {
+    if (alphabetSize > MAX_ALPHABET) throw std::runtime_error("Alphabet too large for the histogram");
+    std::fill(counts, counts + alphabetSize, 0);
+    Banks banks;
+    while (count > 0) {
+        size_t chunk = std::min(count, CHUNK_SIZE);
+        for (uint32_t *bank : banks) std::memset(bank, 0, alphabetSize * sizeof(uint32_t));
+
+        size_t i = 0;
+        for (; i + 8 <= chunk; i += 8) {
+            banks[0][symbols[i]]++;
+            banks[1][symbols[i + 1]]++;
+            banks[2][symbols[i + 2]]++;
+            banks[3][symbols[i + 3]]++;
+            banks[4][symbols[i + 4]]++;
+            banks[5][symbols[i + 5]]++;
+            banks[6][symbols[i + 6]]++;
+            banks[7][symbols[i + 7]]++;
+        }
+        for (; i < chunk; i++) banks[0][symbols[i]]++;
+
+        mergeBanks(banks, alphabetSize, counts);
+        symbols += chunk;
+        count -= chunk;
+    }
+}
+
+double Histogram::entropy(const size_t *counts, size_t alphabetSize) {
+    uint64_t total = 0;
+    for (size_t symbol = 0; symbol < alphabetSize; symbol++) total += counts[symbol];
+    if (total == 0) return 0;
+
+    double bits = 0;
+    for (size_t symbol = 0; symbol < alphabetSize; symbol++) {
+        if (counts[symbol] == 0) continue;
+        double p = static_cast<double>(counts[symbol]) / total;
+        bits -= p * std::log2(p);
+    }
+    return bits;
+}
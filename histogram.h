@@ -0,0 +1,25 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+#include <cstddef>
+#include <cstdint>
+
+// Symbol frequencies over flat count arrays
+// With a single count table, runs of one value stall: every increment waits for the store of the one
+// before it to the same entry. Successive values are counted into separate banks instead, which are
+// summed with SIMD adds at the end
+class Histogram {
+public:
+    // Largest alphabet countSymbols takes
+    static const size_t MAX_ALPHABET = 512;
+
+    // Adds the count of every byte value of data[0..size) to counts[0..256)
+    static void countBytes(const uint8_t *data, size_t size, size_t *counts);
+
+    // Sets counts[0..alphabetSize) to the frequency of every symbol, all symbols must be below alphabetSize
+    static void countSymbols(const uint16_t *symbols, size_t count, size_t alphabetSize, size_t *counts);
+
+    // Order-0 entropy of the counts in bits per symbol, 0 when there are none
+    static double entropy(const size_t *counts, size_t alphabetSize);
+};
+
+#endif // HISTOGRAM_H
@@ -0,0 +1,254 @@
+#include "huffmanDecoder.h"
+#include "huffmanTree.h"
+#include "rskFormat.h"
+#include <algorithm>
+#include <map>
+#include <stdexcept>
+
+// Next 8 bytes of the stream as a big endian word
+static inline uint64_t loadBigEndian64(const uint8_t *p) {
+    uint64_t value = 0;
+    for (int i = 0; i < 8; i++) value = (value << 8) | p[i];
+    return value;
+}
+
+static inline uint64_t lowMask(int bits) {
+    return bits >= 64 ? ~0ULL : ((1ULL << bits) - 1);
+}
+
+// Build the lookup tables from the canonical code lengths
+HuffmanDecoder::HuffmanDecoder(const std::vector<uint8_t> &codeLengths) {
+    std::vector<uint32_t> canonical = huffmanTree::canonicalCodes(codeLengths);
+
+    // Kraft sum in units of 2^-MAX_CODE_LENGTH, an over-subscribed code cannot be decoded
+    uint64_t kraft = 0;
+    std::vector<Code> codes;
+    for (size_t symbol = 0; symbol < codeLengths.size(); symbol++) {
+        int length = codeLengths[symbol];
+        if (!length) continue;
+        kraft += uint64_t(1) << (MAX_CODE_LENGTH - length);
+        maxLength = std::max(maxLength, length);
+        codes.push_back(Code{static_cast<uint16_t>(symbol), canonical[symbol], length});
+    }
+    if (codes.empty()) throw std::runtime_error("Cannot build Huffman decoder from empty code table");
+    if (kraft > (uint64_t(1) << MAX_CODE_LENGTH)) throw std::runtime_error("Corrupt block: over-subscribed Huffman code lengths");
+
+    table.assign(size_t(1) << LOOKUP_BITS, Entry{0, 0, 0, 0, 0});
+    buildLevel(0, LOOKUP_BITS, 0, codes);
+    pairShortCodes();
+
+    // A refill guarantees 56 bits, enough for this many lookups in a row
+    stepsPerRefill = std::max(1, 56 / std::max(maxLength, static_cast<int>(LOOKUP_BITS)));
+}
+
+// Fill the table at offset with codes whose first consumed bits were resolved by the levels above
+// Codes that do not fit are grouped by their next tableBits bits into overflow tables
+void HuffmanDecoder::buildLevel(size_t offset, int tableBits, int consumed, const std::vector<Code> &codes) {
+    std::map<uint32_t, std::vector<Code>> overflow;
+
+    for (const Code &code : codes) {
+        int remaining = code.length - consumed;
+        if (remaining <= tableBits) {
+            // Every index starting with the code resolves to its symbol
+            uint32_t index = static_cast<uint32_t>((code.bits & lowMask(remaining)) << (tableBits - remaining));
+            Entry entry{code.symbol, 1, static_cast<uint8_t>(remaining), static_cast<uint8_t>(remaining), 0};
+            std::fill(table.begin() + offset + index,
+                      table.begin() + offset + index + (size_t(1) << (tableBits - remaining)), entry);
+        } else {
+            uint32_t index = static_cast<uint32_t>((code.bits >> (remaining - tableBits)) & lowMask(tableBits));
+            overflow[index].push_back(code);
+        }
+    }
+
+    for (const auto &group : overflow) {
+        int longest = 0;
+        for (const Code &code : group.second) longest = std::max(longest, code.length - consumed - tableBits);
+        int subBits = std::min(longest, static_cast<int>(OVERFLOW_BITS));
+
+        size_t subOffset = table.size();
+        table.resize(subOffset + (size_t(1) << subBits), Entry{0, 0, 0, 0, 0});
+        table[offset + group.first] = Entry{static_cast<uint32_t>(subOffset), 0,
+                                            static_cast<uint8_t>(tableBits), 0, static_cast<uint8_t>(subBits)};
+        buildLevel(subOffset, subBits, consumed + tableBits, group.second);
+    }
+}
+
+// Let primary entries resolve a second symbol when both codes fit in the lookup bits
+void HuffmanDecoder::pairShortCodes() {
+    const uint32_t size = 1u << LOOKUP_BITS;
+    std::vector<Entry> single(table.begin(), table.begin() + size);
+
+    for (uint32_t i = 0; i < size; i++) {
+        const Entry &first = single[i];
+        if (first.count != 1 || first.length >= LOOKUP_BITS) continue;
+        const Entry &second = single[(i << first.length) & (size - 1)];
+        if (second.count != 1 || first.length + second.length > LOOKUP_BITS) continue;
+
+        table[i].value = first.value | (second.value << 16);
+        table[i].count = 2;
+        table[i].length = static_cast<uint8_t>(first.length + second.length);
+    }
+}
+
+// Top the bit buffer up to at least 56 bits, the reader must have 8 bytes left
+inline void HuffmanDecoder::refill(BitReader &reader) {
+    reader.buf |= loadBigEndian64(reader.p) >> reader.bits;
+    reader.p += (63 - reader.bits) >> 3;
+    reader.bits |= 56;
+}
+
+// One primary lookup: up to two symbols, or one long code through the overflow tables
+// Always stores two symbols, so out needs room for two
+template <typename Symbol>
+inline void HuffmanDecoder::decodeStep(const Entry *lookup, BitReader &reader, Symbol *&out) {
+    Entry e = lookup[reader.buf >> (64 - LOOKUP_BITS)];
+    if (e.count) {
+        out[0] = static_cast<Symbol>(e.value);
+        out[1] = static_cast<Symbol>(e.value >> 16);
+        out += e.count;
+    } else {
+        while (e.count == 0) {
+            if (e.subBits == 0) throw std::runtime_error("Corrupt block: invalid Huffman code");
+            reader.buf <<= e.length;
+            reader.bits -= e.length;
+            e = lookup[e.value + (reader.buf >> (64 - e.subBits))];
+        }
+        *out++ = static_cast<Symbol>(e.value);
+    }
+    reader.buf <<= e.length;
+    reader.bits -= e.length;
+}
+
+// One symbol, taking only the bits of its own code
+template <typename Symbol>
+inline void HuffmanDecoder::decodeOne(const Entry *lookup, BitReader &reader, Symbol *&out) {
+    Entry e = lookup[reader.buf >> (64 - LOOKUP_BITS)];
+    while (e.count == 0) {
+        if (e.subBits == 0) throw std::runtime_error("Corrupt block: invalid Huffman code");
+        reader.buf <<= e.length;
+        reader.bits -= e.length;
+        e = lookup[e.value + (reader.buf >> (64 - e.subBits))];
+    }
+    *out++ = static_cast<Symbol>(e.value);
+    reader.buf <<= e.firstLength;
+    reader.bits -= e.firstLength;
+}
+
+// Decode symbols into out until outEnd, continuing from and updating the reader state
+template <typename Symbol>
+Symbol *HuffmanDecoder::decodeRun(BitReader &reader, Symbol *out, Symbol *outEnd) const {
+    const Entry *lookup = table.data();
+    BitReader r = reader;
+
+    // Fast path: whole word refills, up to two symbols per primary lookup
+    while (r.end - r.p >= 8 && outEnd - out >= 2 * stepsPerRefill) {
+        refill(r);
+        for (int step = 0; step < stepsPerRefill; step++) decodeStep(lookup, r, out);
+    }
+
+    // Tail: one symbol per lookup, so nothing past outEnd is taken, stopping at the end of the stream
+    while (out < outEnd) {
+        if (r.end - r.p >= 8) {
+            refill(r);
+        } else {
+            while (r.bits <= 56 && r.p < r.end) {
+                r.buf |= static_cast<uint64_t>(*r.p++) << (56 - r.bits);
+                r.bits += 8;
+            }
+        }
+        decodeOne(lookup, r, out);
+        if (r.bits < 0) throw std::runtime_error("Corrupt block: Huffman stream ended early");
+    }
+
+    reader = r;
+    return out;
+}
+
+// Fast path of all streams at once: one refill each, then the lookups of the streams alternate, so the
+// out-of-order core works on four independent chains. Stops as soon as any stream nears the end of its
+// group or input, decodeRun finishes the rest
+// The readers are copied to locals, which stay in registers while symbols are stored
+template <typename Symbol>
+void HuffmanDecoder::decodeLanes(const HuffmanDecoder *const *decoders, BitReader *readers, Symbol **out,
+                                 Symbol *const *outEnd) {
+    static_assert(HUFFMAN_STREAMS == 4, "decodeLanes is written out for four streams");
+    const Entry *lookup0 = decoders[0]->table.data(), *lookup1 = decoders[1]->table.data();
+    const Entry *lookup2 = decoders[2]->table.data(), *lookup3 = decoders[3]->table.data();
+    int steps = std::min(std::min(decoders[0]->stepsPerRefill, decoders[1]->stepsPerRefill),
+                         std::min(decoders[2]->stepsPerRefill, decoders[3]->stepsPerRefill));
+    BitReader r0 = readers[0], r1 = readers[1], r2 = readers[2], r3 = readers[3];
+    Symbol *out0 = out[0], *out1 = out[1], *out2 = out[2], *out3 = out[3];
+    ptrdiff_t room = 2 * steps;
+
+    while (r0.end - r0.p >= 8 && r1.end - r1.p >= 8 && r2.end - r2.p >= 8 && r3.end - r3.p >= 8 &&
+           outEnd[0] - out0 >= room && outEnd[1] - out1 >= room && outEnd[2] - out2 >= room && outEnd[3] - out3 >= room) {
+        refill(r0);
+        refill(r1);
+        refill(r2);
+        refill(r3);
+        for (int step = 0; step < steps; step++) {
+            decodeStep(lookup0, r0, out0);
+            decodeStep(lookup1, r1, out1);
+            decodeStep(lookup2, r2, out2);
+            decodeStep(lookup3, r3, out3);
+        }
+    }
+
+    readers[0] = r0, readers[1] = r1, readers[2] = r2, readers[3] = r3;
+    out[0] = out0, out[1] = out1, out[2] = out2, out[3] = out3;
+}
+
+// The symbols must use exactly the bits of the stream
+void HuffmanDecoder::checkConsumed(const BitReader &reader, const uint8_t *data, uint64_t totalBits) {
+    uint64_t consumed = static_cast<uint64_t>(reader.p - data) * 8 - reader.bits;
+    if (consumed > totalBits) throw std::runtime_error("Corrupt block: Huffman stream ended early");
+    if (consumed < totalBits) throw std::runtime_error("Corrupt block: unused bits after the Huffman stream");
+}
+
+// Round r decodes group r of every stream: all streams together while they have room, then each one
+// to the end of its group. Tables switch per stream and group, the bit buffers carry over unchanged
+template <typename Symbol>
+void HuffmanDecoder::decodeStreams(const std::vector<HuffmanDecoder> &decoders, const uint8_t *selectors, size_t groupSize,
+                                   const uint8_t *data, const uint64_t *streamBits, Symbol *out, size_t count) {
+    size_t groups = (count + groupSize - 1) / groupSize;
+    BitReader readers[HUFFMAN_STREAMS];
+    const uint8_t *streamData[HUFFMAN_STREAMS];
+    size_t firstGroup[HUFFMAN_STREAMS + 1];
+    const uint8_t *p = data;
+    for (size_t k = 0; k < HUFFMAN_STREAMS; k++) {
+        size_t bytes = static_cast<size_t>((streamBits[k] + 7) / 8);
+        streamData[k] = p;
+        readers[k] = BitReader{p, p + bytes, 0, 0};
+        p += bytes;
+        firstGroup[k] = huffmanStreamStart(groups, k);
+    }
+    firstGroup[HUFFMAN_STREAMS] = groups;
+
+    const HuffmanDecoder *laneDecoders[HUFFMAN_STREAMS];
+    Symbol *laneOut[HUFFMAN_STREAMS];
+    Symbol *laneEnd[HUFFMAN_STREAMS];
+    for (size_t round = 0;; round++) {
+        size_t active = 0;
+        for (size_t k = 0; k < HUFFMAN_STREAMS; k++) {
+            size_t group = firstGroup[k] + round;
+            if (group >= firstGroup[k + 1]) {
+                laneOut[k] = laneEnd[k] = nullptr;
+                continue;
+            }
+            laneDecoders[k] = &decoders[selectors[group]];
+            laneOut[k] = out + group * groupSize;
+            laneEnd[k] = out + std::min((group + 1) * groupSize, count);
+            active++;
+        }
+        if (active == 0) break;
+        if (active == HUFFMAN_STREAMS) decodeLanes(laneDecoders, readers, laneOut, laneEnd);
+        for (size_t k = 0; k < HUFFMAN_STREAMS; k++)
+            if (laneOut[k] != laneEnd[k]) laneDecoders[k]->decodeRun(readers[k], laneOut[k], laneEnd[k]);
+    }
+    for (size_t k = 0; k < HUFFMAN_STREAMS; k++) checkConsumed(readers[k], streamData[k], streamBits[k]);
+}
+
+template void HuffmanDecoder::decodeStreams<uint8_t>(const std::vector<HuffmanDecoder> &, const uint8_t *, size_t,
+                                                     const uint8_t *, const uint64_t *, uint8_t *, size_t);
+template void HuffmanDecoder::decodeStreams<uint16_t>(const std::vector<HuffmanDecoder> &, const uint8_t *, size_t,
+                                                      const uint8_t *, const uint64_t *, uint16_t *, size_t);
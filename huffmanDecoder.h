@@ -0,0 +1,69 @@
+#ifndef HUFFMAN_DECODER_H
+#define HUFFMAN_DECODER_H
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Table driven Huffman decoder over a packed MSB-first bitstream
+// A primary table indexed by the next LOOKUP_BITS bits resolves one symbol per lookup,
+// or two when both codes fit in the lookup. Longer codes continue in overflow tables
+// A block's symbols are split into several streams, which are decoded in lockstep so that the lookups
+// of one stream overlap with those of the others instead of waiting on the previous code length
+class HuffmanDecoder {
+    struct Entry {
+        uint32_t value;       // Symbols (first in the low half), or offset of the linked overflow table
+        uint8_t count;        // Symbols resolved by this entry, 0 links to an overflow table
+        uint8_t length;       // Bits consumed by all resolved symbols, or by this table level for links
+        uint8_t firstLength;  // Bits consumed by the first symbol alone
+        uint8_t subBits;      // Index width of the linked overflow table, 0 marks an unused code
+    };
+
+    struct Code {
+        uint16_t symbol;
+        uint64_t bits;  // Right aligned code bits
+        int length;
+    };
+
+    // Position in the packed stream, handed from decoder to decoder when tables switch
+    struct BitReader {
+        const uint8_t *p;
+        const uint8_t *end;
+        uint64_t buf;  // Unconsumed bits, left aligned
+        int bits;
+    };
+
+    std::vector<Entry> table;
+    int maxLength = 0;
+    int stepsPerRefill = 1;
+
+    void buildLevel(size_t offset, int tableBits, int consumed, const std::vector<Code> &codes);
+    void pairShortCodes();
+
+    static void refill(BitReader &reader);
+    template <typename Symbol>
+    static void decodeStep(const Entry *lookup, BitReader &reader, Symbol *&out);
+    template <typename Symbol>
+    static void decodeOne(const Entry *lookup, BitReader &reader, Symbol *&out);
+    template <typename Symbol>
+    Symbol *decodeRun(BitReader &reader, Symbol *out, Symbol *outEnd) const;
+    template <typename Symbol>
+    static void decodeLanes(const HuffmanDecoder *const *decoders, BitReader *readers, Symbol **out, Symbol *const *outEnd);
+    static void checkConsumed(const BitReader &reader, const uint8_t *data, uint64_t totalBits);
+
+public:
+    static const int LOOKUP_BITS = 11;
+    static const int OVERFLOW_BITS = 8;
+
+    // Builds the canonical code defined by the code length of every symbol (0 = absent)
+    explicit HuffmanDecoder(const std::vector<uint8_t> &codeLengths);
+
+    // Decodes count symbols coded as HUFFMAN_STREAMS streams of streamBits[k] bits each, laid out
+    // back to back from data (see rskFormat.h); every group of groupSize symbols is coded with the
+    // decoder named by the group's selector
+    // Symbol is uint8_t for byte alphabets and uint16_t for larger ones
+    template <typename Symbol>
+    static void decodeStreams(const std::vector<HuffmanDecoder> &decoders, const uint8_t *selectors, size_t groupSize,
+                              const uint8_t *data, const uint64_t *streamBits, Symbol *out, size_t count);
+};
+
+#endif // HUFFMAN_DECODER_H
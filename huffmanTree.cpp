@@ -1,79 +1,335 @@
 #include "huffmanTree.h"
-#include <queue>
 #include <vector>
-#include <string>
-#include <memory>
-#include <stdexcept>
 #include <stdexcept>
+#include <algorithm>
+#include <iterator>
+#include <cstdint>
+#include "rskFormat.h"
+
+// Huffman code lengths by the two-queue method (van Leeuwen): with the leaves sorted by weight,
+// internal nodes are created in non-decreasing weight order, so the two lightest nodes are
+// always at the front of the leaf queue or of the internal node queue
+// Nodes live in fixed arrays, leaves first and every node before its parent, so the depths
+// follow from one backward pass over the parent links
+// Writes the length of every counted symbol (capped at 255) and returns the longest
+int huffmanTree::treeCodeLengths(const size_t *counts, size_t alphabetSize, std::vector<uint8_t> &codeLengths) {
+    if (alphabetSize > MAX_ALPHABET_SIZE) throw std::runtime_error("Too many symbols for the Huffman tree builder");
+    struct Leaf {
+        size_t weight;
+        uint16_t symbol;
+    } leaves[MAX_ALPHABET_SIZE];
+    size_t n = 0;
+    for (size_t symbol = 0; symbol < alphabetSize; symbol++)
+        if (counts[symbol]) leaves[n++] = {counts[symbol], static_cast<uint16_t>(symbol)};
+    if (n == 0) throw std::runtime_error("Cannot build Huffman tree from empty frequencies");
+    std::stable_sort(leaves, leaves + n, [](const Leaf &a, const Leaf &b) { return a.weight < b.weight; });
 
-// For comparison of two heap nodes
-struct Compare {
-    bool operator()(const std::shared_ptr<minHeapNode> &l, 
-        const std::shared_ptr<minHeapNode> &r
-    ) {
-        return l->freq > r->freq;
+    size_t weight[2 * MAX_ALPHABET_SIZE];
+    uint16_t parent[2 * MAX_ALPHABET_SIZE];
+    uint16_t depth[2 * MAX_ALPHABET_SIZE];
+    for (size_t i = 0; i < n; i++) weight[i] = leaves[i].weight;
+
+    // Next unused leaf, next unused internal node and next node to create
+    size_t leaf = 0, internal = n, next = n;
+    auto takeLightest = [&]() {
+        if (leaf < n && (internal == next || weight[leaf] <= weight[internal])) return leaf++;
+        return internal++;
+    };
+    while (next < 2 * n - 1) {
+        size_t a = takeLightest();
+        size_t b = takeLightest();
+        weight[next] = weight[a] + weight[b];
+        parent[a] = parent[b] = static_cast<uint16_t>(next);
+        next++;
     }
-};
-
-// The main function that builds a Huffman Tree and
-// print codes by traversing the built Huffman Tree
-std::shared_ptr<minHeapNode> huffmanTree::buildHuffmanTree(std::map<uint8_t, size_t> &frequencyMap) {
-    std::priority_queue<std::shared_ptr<minHeapNode>, 
-                    std::vector<std::shared_ptr<minHeapNode>>, 
-                    Compare> minHeap;
-
-    if (frequencyMap.empty()) throw std::runtime_error("Cannot build Huffman tree from empty frequency map");
-    
-    // Create a min heap & inserts all characters of frequencyMap
-    for (auto &pair : frequencyMap) {
-        minHeap.push(std::make_shared<minHeapNode>(pair.first, pair.second));
+
+    // The root is the last node; a lone symbol still needs a one bit code
+    int longest = 0;
+    depth[2 * n - 2] = 0;
+    for (size_t i = 2 * n - 2; i-- > 0;) depth[i] = depth[parent[i]] + 1;
+    for (size_t i = 0; i < n; i++) {
+        int length = std::max<int>(depth[i], 1);
+        codeLengths[leaves[i].symbol] = static_cast<uint8_t>(std::min(length, 255));
+        longest = std::max(longest, length);
     }
+    return longest;
+}
 
-    while (minHeap.size() != 1) {
-        auto left = minHeap.top();
-        minHeap.pop();
-        auto right = minHeap.top();
-        minHeap.pop();
-        auto top = std::make_shared<minHeapNode>(left->freq + right->freq);
-        top->left = left;
-        top->right = right;
-        minHeap.push(top);
+// Optimal code lengths no longer than maxLength, by package-merge (Larmore & Hirschberg)
+// Each of the maxLength rounds pairs up the cheapest items of the round below and merges
+// the packages with the leaves; a symbol's length is how often it appears in the 2n - 2
+// cheapest items of the final round
+std::vector<uint8_t> huffmanTree::packageMerge(const size_t *counts, int maxLength, size_t alphabetSize) {
+    struct Item {
+        size_t weight;
+        int symbol;  // Leaf symbol, -1 for packages
+        int left, right;
+    };
+    std::vector<Item> items;
+    std::vector<int> leaves;
+    for (size_t symbol = 0; symbol < alphabetSize; symbol++) {
+        if (!counts[symbol]) continue;
+        leaves.push_back(static_cast<int>(items.size()));
+        items.push_back({counts[symbol], static_cast<int>(symbol), -1, -1});
     }
-    if (minHeap.empty()) throw std::runtime_error("Huffman tree construction failed: empty heap");
-    return minHeap.top();
+    size_t n = leaves.size();
+    if (n < 2 || n > (size_t(1) << maxLength)) throw std::runtime_error("Too many symbols for the code length limit");
+
+    auto lighter = [&items](int a, int b) { return items[a].weight < items[b].weight; };
+    std::stable_sort(leaves.begin(), leaves.end(), lighter);
+
+    std::vector<int> list = leaves;
+    for (int level = 1; level < maxLength; level++) {
+        std::vector<int> packages;
+        for (size_t i = 0; i + 1 < list.size(); i += 2) {
+            packages.push_back(static_cast<int>(items.size()));
+            items.push_back({items[list[i]].weight + items[list[i + 1]].weight, -1, list[i], list[i + 1]});
+        }
+        list.clear();
+        std::merge(leaves.begin(), leaves.end(), packages.begin(), packages.end(), std::back_inserter(list), lighter);
+    }
+
+    std::vector<uint8_t> codeLengths(alphabetSize, 0);
+    std::vector<int> pending(list.begin(), list.begin() + 2 * (n - 1));
+    while (!pending.empty()) {
+        const Item &item = items[pending.back()];
+        pending.pop_back();
+        if (item.symbol >= 0) {
+            codeLengths[item.symbol]++;
+        } else {
+            pending.push_back(item.left);
+            pending.push_back(item.right);
+        }
+    }
+    return codeLengths;
 }
 
-// Saves huffman codes from the Huffman Tree. 
-void huffmanTree::saveCodes(const minHeapNode *root, const std::string &str, std::unordered_map<uint8_t, std::string> &huffmanCodes) {
-    if (!root) return;
-    // Check if it is leaf node from flag
-    if (root->isLeaf) {
-        huffmanCodes[root->data] = str.empty() ? "0" : str;
-        return;
+// Code length of every symbol of the alphabet (0 for absent symbols), at most maxLength bits
+// Uses the plain Huffman tree and falls back to package-merge only when the tree is too deep
+std::vector<uint8_t> huffmanTree::buildCodeLengths(const size_t *counts, int maxLength, size_t alphabetSize) {
+    std::vector<uint8_t> codeLengths(alphabetSize, 0);
+    if (huffmanTree::treeCodeLengths(counts, alphabetSize, codeLengths) > maxLength)
+        return huffmanTree::packageMerge(counts, maxLength, alphabetSize);
+    return codeLengths;
+}
+
+// Canonical codes: symbols ordered by (length, symbol) get consecutive code values,
+// so the code lengths alone define the code
+std::vector<uint32_t> huffmanTree::canonicalCodes(const std::vector<uint8_t> &codeLengths) {
+    uint32_t lengthCount[MAX_CODE_LENGTH + 1] = {0};
+    for (uint8_t length : codeLengths) {
+        if (length > MAX_CODE_LENGTH) throw std::runtime_error("Huffman code length exceeds the limit");
+        if (length) lengthCount[length]++;
+    }
+
+    uint32_t nextCode[MAX_CODE_LENGTH + 1] = {0};
+    uint32_t code = 0;
+    for (int length = 1; length <= MAX_CODE_LENGTH; length++) {
+        code = (code + lengthCount[length - 1]) << 1;
+        nextCode[length] = code;
     }
-    saveCodes(root->left.get(), str + "0", huffmanCodes);
-    saveCodes(root->right.get(), str + "1", huffmanCodes);
+
+    std::vector<uint32_t> codes(codeLengths.size(), 0);
+    for (size_t symbol = 0; symbol < codeLengths.size(); symbol++)
+        if (codeLengths[symbol]) codes[symbol] = nextCode[codeLengths[symbol]]++;
+    return codes;
+}
+
+// Symbol set: a bitmap of the 16-symbol groups holding any symbol, then a 16-bit mask of
+// present symbols for each of those groups
+void huffmanTree::writeSymbolSet(const std::vector<bool> &present, std::vector<uint8_t> &out) {
+    size_t groups = (present.size() + 15) / 16;
+    std::vector<uint16_t> masks(groups, 0);
+    for (size_t symbol = 0; symbol < present.size(); symbol++)
+        if (present[symbol]) masks[symbol / 16] |= static_cast<uint16_t>(1u << (symbol % 16));
+
+    size_t groupMap = out.size();
+    out.resize(out.size() + (groups + 7) / 8, 0);
+    for (size_t group = 0; group < groups; group++)
+        if (masks[group]) out[groupMap + group / 8] |= static_cast<uint8_t>(1u << (group % 8));
+    for (size_t group = 0; group < groups; group++)
+        if (masks[group]) putU16(out, masks[group]);
 }
 
-// Decode character from the huffman codes
-// Start from the root node and traverse the tree based on the bit string
-// If current node is leaf node append its character data into decoded string
-std::vector<uint8_t> huffmanTree::decodeHuffmanTree(const std::shared_ptr<minHeapNode> &root, const std::string &bitString, uint32_t originalSize) {
-    std::vector<uint8_t> decodedMTF;
-    std::shared_ptr<minHeapNode> current = root;
+// Reads a symbol set of an alphabetSize alphabet into present, in ascending order
+// Returns the position just past the set
+const uint8_t *huffmanTree::readSymbolSet(const uint8_t *p, const uint8_t *end, size_t alphabetSize,
+                                          std::vector<size_t> &present) {
+    size_t groups = (alphabetSize + 15) / 16;
+    size_t groupMapSize = (groups + 7) / 8;
+    if (static_cast<size_t>(end - p) < groupMapSize) throw std::runtime_error("Corrupt block: truncated symbol set");
+    const uint8_t *groupMap = p;
+    p += groupMapSize;
 
-    // Read each bit and traverse the huffman tree accordingly
-    for (char bit : bitString) {
-        if (decodedMTF.size() >= originalSize) break;
-        if (!current) break;
+    present.clear();
+    for (size_t group = 0; group < groups; group++) {
+        if (!(groupMap[group / 8] & (1u << (group % 8)))) continue;
+        if (end - p < 2) throw std::runtime_error("Corrupt block: truncated symbol set");
+        uint16_t mask = getU16(p);
+        p += 2;
+        for (int bit = 0; bit < 16; bit++)
+            if (mask & (1u << bit)) present.push_back(group * 16 + bit);
+    }
+    if (present.empty()) throw std::runtime_error("Corrupt block: empty symbol set");
+    if (present.back() >= alphabetSize) throw std::runtime_error("Corrupt block: symbol outside the alphabet");
+    return p;
+}
 
-        current = (bit == '0') ? current->left : current->right;
-        if (!current) break;
+// Packed code lengths: the symbol set, then one 4-bit length per present symbol for every
+// table in turn. All tables code the same set of symbols
+void huffmanTree::writeCodeLengths(const std::vector<std::vector<uint8_t>> &tables, std::vector<uint8_t> &out) {
+    const std::vector<uint8_t> &first = tables.front();
+    std::vector<bool> present(first.size());
+    for (size_t symbol = 0; symbol < first.size(); symbol++) present[symbol] = first[symbol] != 0;
+    huffmanTree::writeSymbolSet(present, out);
 
-        if (!current->left && !current->right) {
-            decodedMTF.push_back(current->data);
-            current = root;
+    bool highNibble = true;
+    for (const std::vector<uint8_t> &codeLengths : tables) {
+        for (size_t symbol = 0; symbol < first.size(); symbol++) {
+            if (!first[symbol]) continue;
+            uint8_t length = codeLengths[symbol];
+            if (!length) throw std::runtime_error("Huffman tables do not code the same symbols");
+            if (highNibble) out.push_back(static_cast<uint8_t>(length << 4));
+            else out.back() |= length;
+            highNibble = !highNibble;
         }
     }
-    return decodedMTF;
-}
\ No newline at end of file
+}
+
+// Reads code lengths written by writeCodeLengths into every table of tables, whose size is the
+// table count and whose entries are sized to the alphabet
+// Returns the position just past the packed lengths
+const uint8_t *huffmanTree::readCodeLengths(const uint8_t *p, const uint8_t *end, std::vector<std::vector<uint8_t>> &tables) {
+    std::vector<size_t> present;
+    p = huffmanTree::readSymbolSet(p, end, tables.front().size(), present);
+
+    size_t nibbles = present.size() * tables.size();
+    if (static_cast<size_t>(end - p) < (nibbles + 1) / 2) throw std::runtime_error("Corrupt block: truncated code lengths");
+    for (size_t t = 0; t < tables.size(); t++) {
+        std::fill(tables[t].begin(), tables[t].end(), 0);
+        for (size_t i = 0; i < present.size(); i++) {
+            size_t nibble = t * present.size() + i;
+            uint8_t length = (nibble % 2 == 0) ? (p[nibble / 2] >> 4) : (p[nibble / 2] & 0x0F);
+            if (length == 0) throw std::runtime_error("Corrupt block: zero code length for a present symbol");
+            tables[t][present[i]] = length;
+        }
+    }
+    return p + (nibbles + 1) / 2;
+}
+
+// Code lengths for up to maxTables Huffman tables and the table selected for every group of
+// HUFFMAN_GROUP_SIZE symbols, refined over passes (at least 1) in the manner of bzip2:
+// tables start out covering bands of the symbol frequencies, then every pass moves each group
+// to its cheapest table and rebuilds every table from the groups it was given
+// counts holds the frequency of every symbol of the alphabet over the whole block
+std::vector<std::vector<uint8_t>> huffmanTree::buildGroupedCodeLengths(
+    const std::vector<uint16_t> &symbols,
+    const std::vector<size_t> &counts,
+    int maxLength,
+    size_t maxTables,
+    int passes,
+    std::vector<uint8_t> &selectors
+) {
+    size_t alphabetSize = counts.size();
+    size_t used = alphabetSize - std::count(counts.begin(), counts.end(), 0);
+    size_t groupCount = (symbols.size() + HUFFMAN_GROUP_SIZE - 1) / HUFFMAN_GROUP_SIZE;
+
+    // Short inputs cannot pay for the extra tables and selectors
+    size_t tableCount = symbols.size() < 200 ? 2 : symbols.size() < 600 ? 3 : symbols.size() < 1200 ? 4
+                      : symbols.size() < 2400 ? 5 : 6;
+    if (symbols.size() < 50 || used < 2) tableCount = 1;
+    tableCount = std::max<size_t>(1, std::min(tableCount, maxTables));
+
+    std::vector<size_t> weights(alphabetSize);
+    auto codeLengthsFor = [&](const std::vector<size_t> &tableCounts) {
+        // Every table has to code every symbol of the block, unseen ones get the smallest weight
+        for (size_t symbol = 0; symbol < alphabetSize; symbol++)
+            weights[symbol] = counts[symbol] ? std::max<size_t>(tableCounts[symbol], 1) : 0;
+        return huffmanTree::buildCodeLengths(weights.data(), maxLength, alphabetSize);
+    };
+
+    selectors.assign(groupCount, 0);
+    if (tableCount == 1) return {codeLengthsFor(counts)};
+
+    // Initial tables: consecutive bands of symbols holding about equal shares of the block,
+    // cheap (length 0) inside the band and expensive outside
+    std::vector<std::vector<uint8_t>> tables(tableCount, std::vector<uint8_t>(alphabetSize, 0));
+    size_t remaining = symbols.size();
+    size_t bandStart = 0;
+    for (size_t part = tableCount; part > 0; part--) {
+        size_t target = remaining / part;
+        size_t bandEnd = bandStart;
+        size_t taken = 0;
+        while (bandEnd < alphabetSize && (taken < target || bandEnd == bandStart)) taken += counts[bandEnd++];
+        if (part == 1) {
+            while (bandEnd < alphabetSize) taken += counts[bandEnd++];
+        }
+        for (size_t symbol = 0; symbol < alphabetSize; symbol++)
+            tables[part - 1][symbol] = (symbol >= bandStart && symbol < bandEnd) ? 0 : static_cast<uint8_t>(maxLength);
+        remaining -= taken;
+        bandStart = bandEnd;
+    }
+
+    std::vector<std::vector<size_t>> tableCounts(tableCount, std::vector<size_t>(alphabetSize));
+    for (int pass = 0; pass < passes; pass++) {
+        for (std::vector<size_t> &c : tableCounts) std::fill(c.begin(), c.end(), 0);
+
+        for (size_t group = 0; group < groupCount; group++) {
+            size_t start = group * HUFFMAN_GROUP_SIZE;
+            size_t end = std::min(start + HUFFMAN_GROUP_SIZE, symbols.size());
+
+            // Bits the group would take under every table
+            size_t best = 0;
+            size_t bestCost = SIZE_MAX;
+            for (size_t t = 0; t < tableCount; t++) {
+                const uint8_t *lengths = tables[t].data();
+                size_t cost = 0;
+                for (size_t i = start; i < end; i++) cost += lengths[symbols[i]];
+                if (cost < bestCost) {
+                    bestCost = cost;
+                    best = t;
+                }
+            }
+            selectors[group] = static_cast<uint8_t>(best);
+            for (size_t i = start; i < end; i++) tableCounts[best][symbols[i]]++;
+        }
+
+        for (size_t t = 0; t < tableCount; t++) tables[t] = codeLengthsFor(tableCounts[t]);
+    }
+
+    // Drop tables no group ended up with
+    std::vector<int> remap(tableCount, -1);
+    std::vector<std::vector<uint8_t>> kept;
+    for (uint8_t &selector : selectors) {
+        if (remap[selector] < 0) {
+            remap[selector] = static_cast<int>(kept.size());
+            kept.push_back(tables[selector]);
+        }
+        selector = static_cast<uint8_t>(remap[selector]);
+    }
+
+    // Keep the tables only if they beat a single table once their code lengths and selectors
+    // are paid for; selectors are counted at their move to front unary size
+    uint64_t groupedBits = static_cast<uint64_t>(kept.size() - 1) * used * 4;
+    uint8_t recent[MAX_HUFFMAN_TABLES];
+    for (int t = 0; t < MAX_HUFFMAN_TABLES; t++) recent[t] = static_cast<uint8_t>(t);
+    for (size_t group = 0; group < groupCount; group++) {
+        int position = 0;
+        while (recent[position] != selectors[group]) position++;
+        for (int i = position; i > 0; i--) recent[i] = recent[i - 1];
+        recent[0] = selectors[group];
+        groupedBits += position + 1;
+
+        const uint8_t *lengths = kept[selectors[group]].data();
+        size_t end = std::min((group + 1) * HUFFMAN_GROUP_SIZE, symbols.size());
+        for (size_t i = group * HUFFMAN_GROUP_SIZE; i < end; i++) groupedBits += lengths[symbols[i]];
+    }
+    std::vector<uint8_t> single = codeLengthsFor(counts);
+    uint64_t singleBits = 0;
+    for (size_t symbol = 0; symbol < alphabetSize; symbol++) singleBits += static_cast<uint64_t>(counts[symbol]) * single[symbol];
+    if (singleBits <= groupedBits) {
+        selectors.assign(groupCount, 0);
+        return {single};
+    }
+    return kept;
+}
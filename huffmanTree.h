@@ -1,31 +1,30 @@
 #ifndef HUFFMAN_TREE_H
 #define HUFFMAN_TREE_H
 
-#include <memory>
-#include <string>
-#include <unordered_map>
-#include <map>
-#include <queue>
+#include <cstddef>
+#include <vector>
+#include <cstdint>
 
-class minHeapNode {
-public:
-    size_t data;
-    unsigned freq;
-    bool isLeaf; 
-    std::shared_ptr<minHeapNode> left, right;
-
-    minHeapNode(char data, unsigned freq) 
-        : data(data), freq(freq), isLeaf(true), left(nullptr), right(nullptr) {}
-    
-    minHeapNode(unsigned freq) 
-        : data('\0'), freq(freq), isLeaf(false), left(nullptr), right(nullptr) {}
-};
+// Longest code a symbol may get, so every length fits in the 4 bits stored per symbol
+#define MAX_CODE_LENGTH 15
+// Largest alphabet the tree builder works on, it keeps all nodes in fixed size arrays
+#define MAX_ALPHABET_SIZE 512
+// Most refinement passes of the grouped table builder
+#define MAX_REFINE_PASSES 16
 
 class huffmanTree {
 public:
-    static std::shared_ptr<minHeapNode> buildHuffmanTree(std::map<uint8_t, size_t> &frequencyMap);
-    static void saveCodes(const minHeapNode *root, const std::string &str, std::unordered_map<uint8_t, std::string> &huffmanCodes);
-    static std::vector<uint8_t> decodeHuffmanTree(const std::shared_ptr<minHeapNode> &root, const std::string &bitString, uint32_t originalSize);
+    // counts holds the frequency of every symbol of the alphabet, 0 for absent ones
+    static int treeCodeLengths(const size_t *counts, size_t alphabetSize, std::vector<uint8_t> &codeLengths);
+    static std::vector<uint8_t> packageMerge(const size_t *counts, int maxLength, size_t alphabetSize);
+    static std::vector<uint8_t> buildCodeLengths(const size_t *counts, int maxLength, size_t alphabetSize);
+    static std::vector<uint32_t> canonicalCodes(const std::vector<uint8_t> &codeLengths);
+    static std::vector<std::vector<uint8_t>> buildGroupedCodeLengths(const std::vector<uint16_t> &symbols,
+        const std::vector<size_t> &counts, int maxLength, size_t maxTables, int passes, std::vector<uint8_t> &selectors);
+    static void writeSymbolSet(const std::vector<bool> &present, std::vector<uint8_t> &out);
+    static const uint8_t *readSymbolSet(const uint8_t *p, const uint8_t *end, size_t alphabetSize, std::vector<size_t> &present);
+    static void writeCodeLengths(const std::vector<std::vector<uint8_t>> &tables, std::vector<uint8_t> &out);
+    static const uint8_t *readCodeLengths(const uint8_t *p, const uint8_t *end, std::vector<std::vector<uint8_t>> &tables);
 };
 
 #endif //HUFFMAN_TREE_H
\ No newline at end of file
@@ -1,26 +1,181 @@
 // C++ program for File Compression/Decompression using Huffman Coding with STL
 // use ./a.out <filename> -c to compress file
 // use ./a.out <compressed_filename> -d to decompress file
+// use ./a.out <compressed_filename> -t to decode and verify the CRC32C checksums without writing output
+// use ./a.out <compressed_filename> -d --range=offset:length to write only those original bytes to stdout
+// use ./a.out <filename> -c --bwt-rotation-sort to compress with the reference BWT sort
+// use ./a.out <filename> -c --block-size=900k --threads=8 to tune block size and worker count
+// use ./a.out - -c < in > out.rsk or ./a.out <filename> -c --stream > out.rsk to stream through stdin/stdout
+// use ./a.out <filename> -c --no-zero-runs to Huffman code MTF output without the zero run stage
+// use ./a.out <filename> -c --tables=N to let each block switch between at most N Huffman tables (1-6)
+// use ./a.out <filename> -c -1 ... -9 to pick a compression level, from fastest to strongest (default 6)
+// use ./a.out <filename> -c --no-sampling to send every block through the BWT, even when a sample says it will not help
+// use ./a.out <filename> -c --no-rans to Huffman code every block instead of choosing rANS where it codes smaller
+// use ./a.out <filename> -c --stats or --stats=json to report stage timings, memory and coding statistics
+// use ./a.out <archive.rsa> -a <file|directory|@list>... to pack files and directories into one archive
+// use ./a.out <archive.rsa> -x [member...] to extract every member, or only the named ones
+// use ./a.out <archive.rsa> -l to list the members with their sizes and CRC32C checksums
 
 #include <iostream>
+#include <iomanip>
+#include <fstream>
 #include <string>
 #include <utility>
+#include <vector>
 #include <stdexcept>
+#include "archive.h"
 #include "compressor.h"
 #include "decompressor.h"
+#include "pipelineStats.h"
+
+// Parses a byte count with an optional k/m suffix, e.g. 900k or 4m
+static size_t parseSize(const std::string &value) {
+    size_t pos = 0;
+    unsigned long long size = std::stoull(value, &pos);
+    std::string suffix = value.substr(pos);
+    if (suffix == "k" || suffix == "K") size *= 1024;
+    else if (suffix == "m" || suffix == "M") size *= 1024 * 1024;
+    else if (!suffix.empty()) throw std::runtime_error("Invalid size: " + value);
+    return static_cast<size_t>(size);
+}
+
+// Parses offset:length, both byte counts as for parseSize
+static std::pair<uint64_t, uint64_t> parseRange(const std::string &value) {
+    size_t colon = value.find(':');
+    if (colon == std::string::npos) throw std::runtime_error("Invalid range, expected offset:length: " + value);
+    return std::make_pair(static_cast<uint64_t>(parseSize(value.substr(0, colon))),
+                          static_cast<uint64_t>(parseSize(value.substr(colon + 1))));
+}
 
 int main(int argc, char *argv[]) {
     try {
         if (argc < 3) {
-            std::cerr << "Usage: " << argv[0] << " <filename> [-c|-d]" << std::endl;
+            std::cerr << "Usage: " << argv[0] << " <filename> [-c|-d|-t|-a|-x|-l] [-1..-9] [--bwt-rotation-sort] [--block-size=N[k|m]] [--threads=N] [--stream] [--no-zero-runs] [--tables=N] [--no-sampling] [--no-rans] [--range=offset:length] [--stats[=json]]" << std::endl;
+            std::cerr << "Use - as filename to read from stdin; --stream writes the result to stdout" << std::endl;
+            std::cerr << "Archives: " << argv[0] << " <archive.rsa> -a <file|directory|@list>... | -x [member...] | -l" << std::endl;
             return 1;
         }
         std::string filename = argv[1];
         std::string arg = argv[2];
-        std::pair<size_t, size_t> sizes;
+        // A level sets every engine option at once, options given with it override its choices
+        CompressionOptions options;
+        for (int i = 3; i < argc; i++) {
+            std::string opt = argv[i];
+            if (opt.size() == 2 && opt[0] == '-' && opt[1] >= '0' && opt[1] <= '9') options = CompressionOptions::forLevel(opt[1] - '0');
+        }
+        bool stream = (filename == "-");
+        bool stats = false;
+        bool statsJSON = false;
+        bool range = false;
+        std::pair<uint64_t, uint64_t> rangeBounds;
+        // Archive modes take the inputs or member names as further arguments
+        bool archiveMode = (arg == "-a" || arg == "-x");
+        std::vector<std::string> operands;
+        for (int i = 3; i < argc; i++) {
+            std::string opt = argv[i];
+            if (opt.size() == 2 && opt[0] == '-' && opt[1] >= '0' && opt[1] <= '9') continue;
+            else if (archiveMode && (opt.empty() || opt[0] != '-')) operands.push_back(opt);
+            else if (opt == "--bwt-rotation-sort") options.engine = BWTEngine::RotationSort;
+            else if (opt.rfind("--block-size=", 0) == 0) options.blockSize = parseSize(opt.substr(13));
+            else if (opt.rfind("--threads=", 0) == 0) options.threads = std::stoul(opt.substr(10));
+            else if (opt == "--stream") stream = true;
+            else if (opt == "--no-zero-runs") options.zeroRuns = false;
+            else if (opt.rfind("--tables=", 0) == 0) options.huffmanTables = std::stoul(opt.substr(9));
+            else if (opt == "--no-sampling") options.sampleBlocks = false;
+            else if (opt == "--no-rans") options.rans = false;
+            else if (opt.rfind("--range=", 0) == 0 || (opt == "--range" && i + 1 < argc)) {
+                range = true;
+                rangeBounds = parseRange(opt == "--range" ? argv[++i] : opt.substr(8));
+            }
+            else if (opt == "--stats") stats = true;
+            else if (opt == "--stats=json") stats = statsJSON = true;
+            else {
+                std::cerr << "Unknown option: " << opt << std::endl;
+                return 1;
+            }
+        }
+
+        // Collection starts here so the totals cover the whole run
+        PipelineStats collector;
+        if (stats) options.stats = &collector;
+
+        // Range mode: only the blocks holding the range are decoded, its bytes go to stdout
+        // The block index is needed to find them, so the input has to be a file
+        if (range) {
+            if (arg != "-d" && arg != "-D") throw std::runtime_error("--range only applies to -d");
+            if (filename == "-") throw std::runtime_error("--range needs a compressed file, not stdin");
+            std::vector<uint8_t> slice;
+            std::pair<size_t, size_t> sizes = Decompressor::ReadRange(filename, rangeBounds.first, rangeBounds.second, slice,
+                                                                      options.threads, options.stats);
+            std::cout.write(reinterpret_cast<const char *>(slice.data()), slice.size());
+            std::cout.flush();
+            if (!std::cout) throw std::runtime_error("Failed writing decompressed output");
+            // The statistics cover the blocks decoded for the range
+            collector.finish("decompress", sizes.second, sizes.first);
+            if (stats) collector.report(std::cerr, statsJSON);
+            return 0;
+        }
+
+        // Streaming mode: input from stdin or the named file, output to stdout in bounded memory
+        // stdout carries the data, so no progress report is printed and statistics go to stderr
+        if (stream) {
+            std::ifstream file;
+            std::istream *in = &std::cin;
+            if (filename != "-") {
+                file.open(filename, std::ios::binary);
+                if (!file) throw std::runtime_error("Unable to open " + filename);
+                in = &file;
+            }
             if (arg == "-c" || arg == "-C") {
-                Compressor C;
-                sizes = Compressor::Compress(filename);
+                size_t dotPos = filename.rfind('.');
+                std::string originalExt = (filename != "-" && dotPos != std::string::npos) ? filename.substr(dotPos) : "";
+                std::pair<size_t, size_t> sizes = Compressor::CompressStream(*in, std::cout, options, originalExt);
+                collector.finish("compress", sizes.first, sizes.second);
+            }
+            else if (arg == "-d" || arg == "-D") {
+                std::pair<size_t, size_t> sizes = Decompressor::DecompressStream(*in, std::cout, options.threads, options.stats);
+                collector.finish("decompress", sizes.second, sizes.first);
+            }
+            else if (arg == "-t" || arg == "-T") {
+                std::pair<size_t, size_t> sizes = Decompressor::TestStream(*in, options.threads, options.stats);
+                collector.finish("test", sizes.second, sizes.first);
+                std::cout << "OK: " << sizes.second << " bytes verified\n";
+            }
+            else {
+                std::cerr << "Invalid choice. Use -c to compress, -d to decompress or -t to test.\n";
+                return 1;
+            }
+            if (stats) collector.report(std::cerr, statsJSON);
+            return 0;
+        }
+
+        std::pair<size_t, size_t> sizes;
+        if (arg == "-a") {
+            sizes = Archive::Create(filename, operands, options);
+            collector.finish("compress", sizes.first, sizes.second);
+            std::cout << "Archive " << filename << " created\n";
+            std::cout << "Initial size: " << sizes.first << " bytes\n";
+            std::cout << "Final size: " << sizes.second << " bytes\n";
+            if (sizes.first > 0)
+                std::cout << "Compression ratio: " << (100.0 * sizes.second / sizes.first) << "%\n";
+        }
+        else if (arg == "-x") {
+            size_t dotPos = filename.rfind('.');
+            std::string outputDir = "decompressed_" + ((dotPos != std::string::npos) ? filename.substr(0, dotPos) : filename);
+            sizes = Archive::Extract(filename, operands, outputDir, options.threads, options.stats);
+            collector.finish("decompress", sizes.second, sizes.first);
+            std::cout << "Extraction complete, members saved below " << outputDir << "\n";
+            std::cout << "Extracted size: " << sizes.second << " bytes\n";
+        }
+        else if (arg == "-l") {
+            for (const Archive::Member &member : Archive::List(filename))
+                std::cout << std::setw(12) << member.size << "  " << std::hex << std::setw(8) << std::setfill('0')
+                          << member.crc << std::dec << std::setfill(' ') << "  " << member.name << "\n";
+            return 0;
+        }
+        else if (arg == "-c" || arg == "-C") {
+                sizes = Compressor::Compress(filename, options);
+                collector.finish("compress", sizes.first, sizes.second);
                 std::cout << "Compression complete\n";
                 std::cout << "Initial size: " << sizes.first << " bytes\n";
                 if(sizes.second)
@@ -33,7 +188,8 @@ int main(int argc, char *argv[]) {
                     std::cout << "Compression ratio: N/A (zero input size)\n";
             }
             else if (arg == "-d" || arg == "-D") {
-                sizes = Decompressor::Decompress(filename);
+                sizes = Decompressor::Decompress(filename, options.threads, options.stats);
+                collector.finish("decompress", sizes.second, sizes.first);
                 std::cout << "Decompression complete\n";
                 std::cout << "Initial size: " << sizes.first << " bytes\n";
                 if(sizes.second)
@@ -41,9 +197,18 @@ int main(int argc, char *argv[]) {
                 else
                     std::cout << "Final size: Invalid bytes\n";
         }
+            else if (arg == "-t" || arg == "-T") {
+                sizes = Decompressor::Test(filename, options.threads, options.stats);
+                collector.finish("test", sizes.second, sizes.first);
+                std::cout << "Test complete: " << filename << " is OK\n";
+                std::cout << "Compressed size: " << sizes.first << " bytes\n";
+                std::cout << "Verified size: " << sizes.second << " bytes\n";
+            }
         else {
-            std::cout << "Invalid choice. Use -c to compress or -d to decompress.\n";
+            std::cout << "Invalid choice. Use -c to compress, -d to decompress, -t to test, -a to archive, -x to extract or -l to list.\n";
+            return 0;
         }
+        if (stats) collector.report(std::cout, statsJSON);
     }
     catch (const std::exception &e) {
         std::cerr << "Error: " << e.what() << std::endl;
@@ -0,0 +1,80 @@
+#include "mappedFile.h"
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static std::runtime_error systemError(const std::string &what, const std::string &filename) {
+    return std::runtime_error(what + " " + filename + ": " + std::strerror(errno));
+}
+
+// Map the whole file read-only and hint the kernel to read ahead
+MappedFile::MappedFile(const std::string &filename) {
+    fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) throw systemError("Failed to open file", filename);
+
+    struct stat stat_buf;
+    if (fstat(fd, &stat_buf) != 0) {
+        ::close(fd);
+        throw systemError("Failed to read size of", filename);
+    }
+    length = static_cast<size_t>(stat_buf.st_size);
+
+    // mmap rejects zero length mappings, an empty file simply has no data
+    if (length == 0) return;
+    void *p = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED) {
+        ::close(fd);
+        throw systemError("Failed to map file", filename);
+    }
+    mapping = static_cast<uint8_t *>(p);
+    posix_madvise(mapping, length, POSIX_MADV_SEQUENTIAL);
+}
+
+MappedFile::~MappedFile() {
+    if (mapping) munmap(mapping, length);
+    if (fd >= 0) ::close(fd);
+}
+
+// Create or truncate the file, reserve size bytes on disk and map them writable
+MappedOutputFile::MappedOutputFile(const std::string &filename, size_t size) : length(size) {
+    fd = ::open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) throw systemError("Failed to create output file", filename);
+
+    if (length == 0) return;
+    // Filesystems without preallocation still get the right size, only the early space check is lost
+    int rc = posix_fallocate(fd, 0, static_cast<off_t>(length));
+    if ((rc == EOPNOTSUPP || rc == EINVAL) && ftruncate(fd, static_cast<off_t>(length)) == 0) rc = 0;
+    if (rc != 0) {
+        ::close(fd);
+        errno = rc;
+        throw systemError("Failed to reserve space for", filename);
+    }
+    void *p = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+        ::close(fd);
+        throw systemError("Failed to map output file", filename);
+    }
+    mapping = static_cast<uint8_t *>(p);
+}
+
+MappedOutputFile::~MappedOutputFile() {
+    if (mapping) munmap(mapping, length);
+    if (fd >= 0) ::close(fd);
+}
+
+void MappedOutputFile::close() {
+    if (mapping && munmap(mapping, length) != 0) {
+        mapping = nullptr;
+        throw std::runtime_error(std::string("Failed to unmap output file: ") + std::strerror(errno));
+    }
+    mapping = nullptr;
+    if (fd >= 0 && ::close(fd) != 0) {
+        fd = -1;
+        throw std::runtime_error(std::string("Failed to close output file: ") + std::strerror(errno));
+    }
+    fd = -1;
+}
@@ -0,0 +1,45 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Read-only memory mapping of a whole file
+// The pipeline reads blocks straight out of the mapping instead of copying them into buffers
+class MappedFile {
+    int fd = -1;
+    uint8_t *mapping = nullptr;
+    size_t length = 0;
+
+public:
+    explicit MappedFile(const std::string &filename);
+    ~MappedFile();
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    // Null for an empty file
+    const uint8_t *data() const { return mapping; }
+    size_t size() const { return length; }
+};
+
+// Writable memory mapping of a new file created at its final size
+// Disk space is reserved up front, so stores into the mapping cannot fail on a full disk
+class MappedOutputFile {
+    int fd = -1;
+    uint8_t *mapping = nullptr;
+    size_t length = 0;
+
+public:
+    MappedOutputFile(const std::string &filename, size_t size);
+    ~MappedOutputFile();
+    MappedOutputFile(const MappedOutputFile &) = delete;
+    MappedOutputFile &operator=(const MappedOutputFile &) = delete;
+
+    uint8_t *data() { return mapping; }
+    size_t size() const { return length; }
+
+    // Unmaps and closes the file, reporting any error the destructor would have to swallow
+    void close();
+};
+
+#endif // MAPPED_FILE_H
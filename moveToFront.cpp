@@ -0,0 +1,59 @@
+#include "moveToFront.h"
+#include <cstring>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Table starting in the identity order, as both sides expect
+static inline void initTable(uint8_t *table) {
+    for (int i = 0; i < 256; i++) table[i] = static_cast<uint8_t>(i);
+}
+
+// Position of symbol in the table, which always holds every byte value exactly once
+static inline size_t findSymbol(const uint8_t *table, uint8_t symbol) {
+#if defined(__SSE2__)
+    const __m128i needle = _mm_set1_epi8(static_cast<char>(symbol));
+    for (size_t base = 0;; base += 16) {
+        __m128i chunk = _mm_load_si128(reinterpret_cast<const __m128i *>(table + base));
+        unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle)));
+        if (mask) return base + __builtin_ctz(mask);
+    }
+#else
+    return static_cast<const uint8_t *>(std::memchr(table, symbol, 256)) - table;
+#endif
+}
+
+// Shift the entries in front of position one place back and put symbol first
+static inline void moveToFront(uint8_t *table, size_t position, uint8_t symbol) {
+    std::memmove(table + 1, table, position);
+    table[0] = symbol;
+}
+
+void MoveToFront::encode(const uint8_t *in, size_t n, uint8_t *out) {
+    alignas(16) uint8_t table[256];
+    initTable(table);
+
+    for (size_t i = 0; i < n; i++) {
+        uint8_t symbol = in[i];
+        // Runs of the front symbol dominate BWT output, so check it before searching
+        if (table[0] == symbol) {
+            out[i] = 0;
+            continue;
+        }
+        size_t position = findSymbol(table, symbol);
+        out[i] = static_cast<uint8_t>(position);
+        moveToFront(table, position, symbol);
+    }
+}
+
+void MoveToFront::decode(const uint8_t *in, size_t n, uint8_t *out) {
+    alignas(16) uint8_t table[256];
+    initTable(table);
+
+    for (size_t i = 0; i < n; i++) {
+        size_t position = in[i];
+        uint8_t symbol = table[position];
+        out[i] = symbol;
+        if (position) moveToFront(table, position, symbol);
+    }
+}
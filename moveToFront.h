@@ -0,0 +1,17 @@
+#ifndef MOVE_TO_FRONT_H
+#define MOVE_TO_FRONT_H
+#include <cstddef>
+#include <cstdint>
+
+// Move to front coding over a contiguous 256-byte recency table
+// Symbols are located 16 table entries per compare and moved to the front with one memmove
+// Shared by the compressor and the decompressor so both sides keep the same table
+class MoveToFront {
+public:
+    // Replaces every byte of in[0..n) by its current position in the table, then moves it to the front
+    static void encode(const uint8_t *in, size_t n, uint8_t *out);
+    // Replaces every position of in[0..n) by the byte at that position, then moves the byte to the front
+    static void decode(const uint8_t *in, size_t n, uint8_t *out);
+};
+
+#endif // MOVE_TO_FRONT_H
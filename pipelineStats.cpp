@@ -0,0 +1,138 @@
+#include "pipelineStats.h"
+#include "histogram.h"
+#include <iomanip>
+#include <ostream>
+#include <time.h>
+#include <sys/resource.h>
+
+static const char *const STAGE_NAMES[] = {
+    "read", "sampling", "bwt", "mtf", "zero_runs", "histogram", "tree_build", "bit_packing",
+    "header_parse", "huffman_decode", "inverse_zero_runs", "inverse_mtf", "inverse_bwt", "crc32c", "write"
+};
+static_assert(sizeof(STAGE_NAMES) / sizeof(STAGE_NAMES[0]) == static_cast<size_t>(Stage::Count), "Every stage needs a name");
+
+static uint64_t clockNs(clockid_t clock) {
+    timespec ts;
+    clock_gettime(clock, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + static_cast<uint64_t>(ts.tv_nsec);
+}
+
+PipelineStats::PipelineStats()
+    : startWallNs(clockNs(CLOCK_MONOTONIC)), startCpuNs(clockNs(CLOCK_PROCESS_CPUTIME_ID)) {}
+
+PipelineStats::Timer::Timer(PipelineStats *stats, Stage stage) : stats(stats), stage(stage) {
+    if (!stats) return;
+    wallStart = clockNs(CLOCK_MONOTONIC);
+    cpuStart = clockNs(CLOCK_THREAD_CPUTIME_ID);
+}
+
+PipelineStats::Timer::~Timer() {
+    if (!stats) return;
+    StageTime &time = stats->stages[static_cast<size_t>(stage)];
+    time.wallNs += clockNs(CLOCK_MONOTONIC) - wallStart;
+    time.cpuNs += clockNs(CLOCK_THREAD_CPUTIME_ID) - cpuStart;
+    time.calls++;
+}
+
+// Count into a local table first so the lock is held for 256 additions, not n
+void PipelineStats::countData(const uint8_t *data, size_t n) {
+    size_t local[256] = {};
+    Histogram::countBytes(data, n, local);
+    std::lock_guard<std::mutex> lock(mutex);
+    for (int i = 0; i < 256; i++) dataHistogram[i] += local[i];
+}
+
+void PipelineStats::countMTF(const uint8_t *data, size_t n) {
+    size_t local[256] = {};
+    Histogram::countBytes(data, n, local);
+    std::lock_guard<std::mutex> lock(mutex);
+    for (int i = 0; i < 256; i++) mtfHistogram[i] += local[i];
+}
+
+void PipelineStats::addPayload(uint64_t symbols, uint64_t bits, bool rans, size_t tables) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (rans) ransBlocks++;
+    codedTables += tables;
+    if (tables > 1) groupedBlocks++;
+    codedSymbols += symbols;
+    payloadBits += bits;
+    payloadBytes += (bits + 7) / 8;
+}
+
+void PipelineStats::countBlock(BlockMode mode, size_t size) {
+    std::lock_guard<std::mutex> lock(mutex);
+    blocks[static_cast<size_t>(mode)]++;
+    if (mode == BlockMode::Stored) storedBytes += size;
+}
+
+void PipelineStats::finish(const std::string &operation, uint64_t originalBytes, uint64_t compressedBytes) {
+    totalWallNs = clockNs(CLOCK_MONOTONIC) - startWallNs;
+    totalCpuNs = clockNs(CLOCK_PROCESS_CPUTIME_ID) - startCpuNs;
+    this->operation = operation;
+    this->originalBytes = originalBytes;
+    this->compressedBytes = compressedBytes;
+}
+
+// Text table or a single JSON object; stages that never ran are left out
+void PipelineStats::report(std::ostream &out, bool json) const {
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    uint64_t peakRSS = static_cast<uint64_t>(usage.ru_maxrss) * 1024;  // Linux reports kilobytes
+
+    double inputEntropy = Histogram::entropy(dataHistogram, 256);
+    double mtfEntropy = Histogram::entropy(mtfHistogram, 256);
+    double bitsPerSymbol = codedSymbols ? static_cast<double>(payloadBits) / codedSymbols : 0;
+    double bitsPerByte = originalBytes ? static_cast<double>(payloadBits) / originalBytes : 0;
+    uint64_t codedBlocks = blocks[0] + blocks[1];
+    double tablesPerBlock = codedBlocks ? static_cast<double>(codedTables) / codedBlocks : 0;
+    uint64_t overhead = compressedBytes > payloadBytes + storedBytes ? compressedBytes - payloadBytes - storedBytes : 0;
+
+    std::ios::fmtflags flags = out.flags();
+    std::streamsize precision = out.precision();
+    out << std::fixed;
+    if (json) {
+        out << "{\"operation\": \"" << operation << "\", \"original_bytes\": " << originalBytes
+            << ", \"compressed_bytes\": " << compressedBytes << std::setprecision(6)
+            << ", \"wall_seconds\": " << totalWallNs / 1e9 << ", \"cpu_seconds\": " << totalCpuNs / 1e9
+            << ", \"peak_rss_bytes\": " << peakRSS << ", \"stages\": {";
+        bool first = true;
+        for (size_t s = 0; s < static_cast<size_t>(Stage::Count); s++) {
+            if (stages[s].calls == 0) continue;
+            out << (first ? "" : ", ") << "\"" << STAGE_NAMES[s] << "\": {\"wall_seconds\": " << stages[s].wallNs / 1e9
+                << ", \"cpu_seconds\": " << stages[s].cpuNs / 1e9 << ", \"calls\": " << stages[s].calls << "}";
+            first = false;
+        }
+        out << "}, \"input_entropy_bits_per_byte\": " << inputEntropy
+            << ", \"mtf_entropy_bits_per_byte\": " << mtfEntropy
+            << ", \"average_code_length_bits_per_symbol\": " << bitsPerSymbol
+            << ", \"average_code_length_bits_per_byte\": " << bitsPerByte
+            << ", \"coded_symbols\": " << codedSymbols
+            << ", \"blocks\": {\"full\": " << blocks[0] << ", \"huffman_only\": " << blocks[1]
+            << ", \"stored\": " << blocks[2] << ", \"rans\": " << ransBlocks << ", \"grouped\": " << groupedBlocks << "}"
+            << ", \"tables_per_coded_block\": " << tablesPerBlock
+            << ", \"header_overhead_bytes\": " << overhead << "}\n";
+    } else {
+        out << "Statistics (" << operation << ", stage times summed over threads)\n";
+        out << "  " << std::left << std::setw(20) << "stage" << std::right << std::setw(12) << "wall s"
+            << std::setw(12) << "cpu s" << "\n";
+        out << std::setprecision(4);
+        for (size_t s = 0; s < static_cast<size_t>(Stage::Count); s++) {
+            if (stages[s].calls == 0) continue;
+            out << "  " << std::left << std::setw(20) << STAGE_NAMES[s] << std::right << std::setw(12) << stages[s].wallNs / 1e9
+                << std::setw(12) << stages[s].cpuNs / 1e9 << "\n";
+        }
+        out << "  " << std::left << std::setw(20) << "total (elapsed)" << std::right << std::setw(12) << totalWallNs / 1e9
+            << std::setw(12) << totalCpuNs / 1e9 << "\n";
+        out << std::setprecision(3);
+        out << "Peak RSS: " << peakRSS / 1024 << " KB\n";
+        out << "Order-0 entropy: " << inputEntropy << " bits/byte input, " << mtfEntropy << " bits/byte MTF output\n";
+        out << "Average code length: " << bitsPerSymbol << " bits/symbol over " << codedSymbols << " symbols, "
+            << bitsPerByte << " bits/input byte\n";
+        out << "Blocks: " << blocks[0] << " full, " << blocks[1] << " Huffman only, " << blocks[2] << " stored, "
+            << ransBlocks << " of them rANS coded\n";
+        out << "Tables: " << tablesPerBlock << " per coded block, " << groupedBlocks << " blocks with more than one\n";
+        out << "Header overhead: " << overhead << " bytes\n";
+    }
+    out.flags(flags);
+    out.precision(precision);
+}
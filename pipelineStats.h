@@ -0,0 +1,103 @@
+#ifndef PIPELINE_STATS_H
+#define PIPELINE_STATS_H
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <mutex>
+#include <string>
+#include "blockSampler.h"
+
+// Pipeline stages timed by --stats, in the order they are reported
+enum class Stage {
+    Read,
+    Sampling,
+    BWT,
+    MTF,
+    ZeroRuns,
+    Histogram,
+    TreeBuild,
+    BitPacking,
+    HeaderParse,
+    HuffmanDecode,
+    InverseZeroRuns,
+    InverseMTF,
+    InverseBWT,
+    Checksum,
+    Write,
+    Count
+};
+
+// Collects stage timings and coding statistics of one compression or decompression run
+// Workers add to it concurrently; stage times are summed over all threads
+class PipelineStats {
+    struct StageTime {
+        std::atomic<uint64_t> wallNs{0};
+        std::atomic<uint64_t> cpuNs{0};
+        std::atomic<uint64_t> calls{0};
+    };
+    StageTime stages[static_cast<size_t>(Stage::Count)];
+
+    std::mutex mutex;
+    size_t dataHistogram[256] = {};     // Bytes of the uncompressed data
+    size_t mtfHistogram[256] = {};      // Bytes of the MTF output
+    uint64_t codedSymbols = 0;
+    uint64_t payloadBits = 0;
+    uint64_t payloadBytes = 0;
+    uint64_t blocks[3] = {};            // Blocks of every BlockMode
+    uint64_t storedBytes = 0;           // Bytes copied into stored blocks
+    uint64_t ransBlocks = 0;            // Coded blocks whose payload is rANS rather than Huffman
+    uint64_t codedTables = 0;           // Huffman or rANS tables over all coded blocks
+    uint64_t groupedBlocks = 0;         // Coded blocks switching between more than one table
+
+    uint64_t startWallNs;
+    uint64_t startCpuNs;
+    uint64_t totalWallNs = 0;
+    uint64_t totalCpuNs = 0;
+    std::string operation;
+    uint64_t originalBytes = 0;
+    uint64_t compressedBytes = 0;
+
+public:
+    // Starts the run clocks
+    PipelineStats();
+    PipelineStats(const PipelineStats &) = delete;
+    PipelineStats &operator=(const PipelineStats &) = delete;
+
+    // Adds the wall and thread CPU time of its lifetime to a stage, does nothing without a collector
+    class Timer {
+        PipelineStats *stats;
+        Stage stage;
+        uint64_t wallStart = 0;
+        uint64_t cpuStart = 0;
+
+    public:
+        Timer(PipelineStats *stats, Stage stage);
+        ~Timer();
+        Timer(const Timer &) = delete;
+        Timer &operator=(const Timer &) = delete;
+    };
+
+    // Runs f as one call of stage and returns its result
+    template <typename F>
+    static auto measure(PipelineStats *stats, Stage stage, F f) -> decltype(f()) {
+        Timer timer(stats, stage);
+        return f();
+    }
+
+    // Byte frequencies behind the order-0 entropies
+    void countData(const uint8_t *data, size_t n);
+    void countMTF(const uint8_t *data, size_t n);
+
+    // Huffman or rANS payload of one block coded with tables tables
+    void addPayload(uint64_t symbols, uint64_t bits, bool rans, size_t tables);
+    // Mode of one block of size original bytes
+    void countBlock(BlockMode mode, size_t size);
+
+    // Stops the run clocks, the compressed size less the payloads and stored bytes is header overhead
+    void finish(const std::string &operation, uint64_t originalBytes, uint64_t compressedBytes);
+
+    void report(std::ostream &out, bool json) const;
+};
+
+#endif // PIPELINE_STATS_H
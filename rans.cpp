@@ -0,0 +1,207 @@
+#include "rans.h"
+#include "huffmanTree.h"
+#include "rskFormat.h"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+// States stay in [RANS_LOW, RANS_LOW << 16) between symbols
+// Below 2^31, so the encoder can divide by multiplying with a 32-bit reciprocal
+static const uint32_t RANS_LOW = 1u << 15;
+
+// Rounds every count to its share of SCALE, then settles the rounding error one step at a time on the
+// symbol where the step costs least: counts[s] / frequencies[s] is how fast the cost of s changes
+void Rans::normalize(const size_t *counts, size_t alphabetSize, uint16_t *frequencies) {
+    uint64_t total = 0;
+    for (size_t symbol = 0; symbol < alphabetSize; symbol++) total += counts[symbol];
+    if (total == 0) throw std::runtime_error("No symbols to normalize");
+
+    int64_t assigned = 0;
+    for (size_t symbol = 0; symbol < alphabetSize; symbol++) {
+        uint64_t scaled = counts[symbol] ? (static_cast<uint64_t>(counts[symbol]) * SCALE + total / 2) / total : 0;
+        if (counts[symbol] && scaled == 0) scaled = 1;
+        frequencies[symbol] = static_cast<uint16_t>(scaled);
+        assigned += static_cast<int64_t>(scaled);
+    }
+    while (assigned != SCALE) {
+        bool grow = assigned < SCALE;
+        size_t best = alphabetSize;
+        double bestRate = 0;
+        for (size_t symbol = 0; symbol < alphabetSize; symbol++) {
+            if (!counts[symbol] || (!grow && frequencies[symbol] == 1)) continue;
+            double rate = static_cast<double>(counts[symbol]) / frequencies[symbol];
+            if (best == alphabetSize || (grow ? rate > bestRate : rate < bestRate)) {
+                best = symbol;
+                bestRate = rate;
+            }
+        }
+        frequencies[best] = static_cast<uint16_t>(grow ? frequencies[best] + 1 : frequencies[best] - 1);
+        assigned += grow ? 1 : -1;
+    }
+}
+
+double Rans::cost(const size_t *counts, const uint16_t *frequencies, size_t alphabetSize) {
+    double bits = 0;
+    for (size_t symbol = 0; symbol < alphabetSize; symbol++)
+        if (counts[symbol]) bits += counts[symbol] * (RANS_SCALE_BITS - std::log2(static_cast<double>(frequencies[symbol])));
+    return bits;
+}
+
+void Rans::writeFrequencies(const std::vector<std::vector<uint16_t>> &tables, std::vector<uint8_t> &out) {
+    size_t alphabetSize = tables.front().size();
+    std::vector<bool> present(alphabetSize, false);
+    for (const std::vector<uint16_t> &table : tables)
+        for (size_t symbol = 0; symbol < alphabetSize; symbol++)
+            if (table[symbol]) present[symbol] = true;
+    huffmanTree::writeSymbolSet(present, out);
+
+    for (const std::vector<uint16_t> &table : tables) {
+        for (size_t symbol = 0; symbol < alphabetSize; symbol++) {
+            if (!present[symbol]) continue;
+            uint16_t frequency = table[symbol];
+            if (frequency < 0x80) {
+                out.push_back(static_cast<uint8_t>(frequency));
+            } else {
+                out.push_back(static_cast<uint8_t>(0x80 | (frequency >> 8)));
+                out.push_back(static_cast<uint8_t>(frequency));
+            }
+        }
+    }
+}
+
+const uint8_t *Rans::readFrequencies(const uint8_t *p, const uint8_t *end, size_t alphabetSize,
+                                     std::vector<std::vector<uint16_t>> &tables) {
+    std::vector<size_t> present;
+    p = huffmanTree::readSymbolSet(p, end, alphabetSize, present);
+    for (std::vector<uint16_t> &table : tables) {
+        table.assign(alphabetSize, 0);
+        uint32_t sum = 0;
+        for (size_t symbol : present) {
+            if (p == end) throw std::runtime_error("Corrupt block: truncated rANS frequencies");
+            uint32_t frequency = *p++;
+            if (frequency & 0x80) {
+                if (p == end) throw std::runtime_error("Corrupt block: truncated rANS frequencies");
+                frequency = ((frequency & 0x7F) << 8) | *p++;
+            }
+            table[symbol] = static_cast<uint16_t>(frequency);
+            sum += frequency;
+        }
+        if (sum != SCALE) throw std::runtime_error("Corrupt block: rANS frequencies do not sum to the scale");
+    }
+    return p;
+}
+
+// Division free encoding of one symbol of frequency freq starting at start, after Alverson:
+// x / freq is computed as a multiply by a rounded up reciprocal and a shift, exact for x < 2^31
+struct EncodeSymbol {
+    uint32_t limit;      // States at or above this renormalize before the symbol is coded
+    uint32_t reciprocal;
+    uint32_t bias;
+    uint16_t complement; // SCALE - freq
+    uint16_t shift;
+};
+
+void Rans::encode(const uint16_t *symbols, size_t count, const uint8_t *selectors, size_t groupSize,
+                  const std::vector<std::vector<uint16_t>> &tables, std::vector<uint8_t> &out) {
+    size_t alphabetSize = tables.front().size();
+    std::vector<EncodeSymbol> encodeTable(tables.size() * alphabetSize);
+    for (size_t t = 0; t < tables.size(); t++) {
+        uint32_t start = 0;
+        for (size_t symbol = 0; symbol < alphabetSize; symbol++) {
+            uint32_t freq = tables[t][symbol];
+            EncodeSymbol &entry = encodeTable[t * alphabetSize + symbol];
+            entry.limit = ((RANS_LOW >> RANS_SCALE_BITS) << 16) * freq;
+            entry.complement = static_cast<uint16_t>(SCALE - freq);
+            if (freq < 2) {
+                // x * (2^32 - 1) >> 32 is x - 1, which the bias makes up for
+                entry.reciprocal = ~0u;
+                entry.shift = 0;
+                entry.bias = start + SCALE - 1;
+            } else {
+                uint32_t shift = 0;
+                while (freq > (1u << shift)) shift++;
+                entry.reciprocal = static_cast<uint32_t>(((1ull << (shift + 31)) + freq - 1) / freq);
+                entry.shift = static_cast<uint16_t>(shift - 1);
+                entry.bias = start;
+            }
+            start += freq;
+        }
+    }
+
+    // The decoder reads forward, so symbols are coded last to first and the words come out reversed
+    uint32_t states[RANS_LANES];
+    for (uint32_t &state : states) state = RANS_LOW;
+    std::vector<uint16_t> words;
+    words.reserve(count / 2);
+    for (size_t i = count; i-- > 0;) {
+        const EncodeSymbol &entry = encodeTable[selectors[i / groupSize] * alphabetSize + symbols[i]];
+        if (entry.limit == 0) throw std::runtime_error("Symbol missing from rANS frequency table");
+        uint32_t &x = states[i % RANS_LANES];
+        if (x >= entry.limit) {
+            words.push_back(static_cast<uint16_t>(x));
+            x >>= 16;
+        }
+        uint32_t quotient = static_cast<uint32_t>((static_cast<uint64_t>(x) * entry.reciprocal) >> 32) >> entry.shift;
+        x += entry.bias + quotient * entry.complement;
+    }
+
+    out.reserve(out.size() + 4 * RANS_LANES + 2 * words.size());
+    for (uint32_t state : states) putU32(out, state);
+    for (size_t i = words.size(); i-- > 0;) putU16(out, words[i]);
+}
+
+// Slot of the decoding table: the symbol owning it, its frequency and the slot's distance from the
+// symbol's first slot
+struct DecodeSlot {
+    uint16_t symbol;
+    uint16_t freq;
+    uint16_t offset;
+};
+
+template <typename Symbol>
+void Rans::decode(const uint8_t *payload, size_t payloadSize, const uint8_t *selectors, size_t groupSize,
+                  const std::vector<std::vector<uint16_t>> &tables, Symbol *out, size_t count) {
+    size_t alphabetSize = tables.front().size();
+    std::vector<DecodeSlot> slots(tables.size() * SCALE);
+    for (size_t t = 0; t < tables.size(); t++) {
+        DecodeSlot *slot = slots.data() + t * SCALE;
+        for (size_t symbol = 0; symbol < alphabetSize; symbol++)
+            for (uint16_t i = 0; i < tables[t][symbol]; i++)
+                *slot++ = {static_cast<uint16_t>(symbol), tables[t][symbol], i};
+    }
+
+    if (payloadSize < 4 * RANS_LANES) throw std::runtime_error("Corrupt block: truncated rANS states");
+    uint32_t states[RANS_LANES];
+    for (size_t lane = 0; lane < RANS_LANES; lane++) {
+        states[lane] = getU32(payload + 4 * lane);
+        if (states[lane] < RANS_LOW || states[lane] >= (RANS_LOW << 16)) throw std::runtime_error("Corrupt block: invalid rANS state");
+    }
+    const uint8_t *p = payload + 4 * RANS_LANES;
+    const uint8_t *end = payload + payloadSize;
+
+    // One table per group; within a group consecutive symbols belong to different lanes, so their
+    // decode steps do not wait on each other
+    for (size_t groupStart = 0; groupStart < count; groupStart += groupSize) {
+        const DecodeSlot *table = slots.data() + static_cast<size_t>(selectors[groupStart / groupSize]) * SCALE;
+        size_t groupEnd = std::min(groupStart + groupSize, count);
+        for (size_t i = groupStart; i < groupEnd; i++) {
+            uint32_t &x = states[i % RANS_LANES];
+            const DecodeSlot &slot = table[x & (SCALE - 1)];
+            out[i] = static_cast<Symbol>(slot.symbol);
+            x = slot.freq * (x >> RANS_SCALE_BITS) + slot.offset;
+            if (x < RANS_LOW) {
+                if (end - p < 2) throw std::runtime_error("Corrupt block: truncated rANS payload");
+                x = (x << 16) | getU16(p);
+                p += 2;
+            }
+        }
+    }
+    if (p != end) throw std::runtime_error("Corrupt block: rANS payload size mismatch");
+    for (uint32_t state : states)
+        if (state != RANS_LOW) throw std::runtime_error("Corrupt block: rANS states do not return to their start");
+}
+
+template void Rans::decode<uint8_t>(const uint8_t *, size_t, const uint8_t *, size_t,
+                                    const std::vector<std::vector<uint16_t>> &, uint8_t *, size_t);
+template void Rans::decode<uint16_t>(const uint8_t *, size_t, const uint8_t *, size_t,
+                                     const std::vector<std::vector<uint16_t>> &, uint16_t *, size_t);
@@ -0,0 +1,48 @@
+#ifndef RANS_H
+#define RANS_H
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Frequencies of every table sum to 1 << RANS_SCALE_BITS
+#define RANS_SCALE_BITS 12
+// Independent coder states, symbol i is coded by state i % RANS_LANES
+#define RANS_LANES 4
+
+// Interleaved rANS coder with static frequency tables
+// Symbols are coded against frequencies normalized to a power of two instead of whole bit codes,
+// so a symbol costs close to its information content even when it is far more likely than 1/2
+// States are 32 bits and renormalize 16 bits at a time; the lanes have no dependency on each
+// other, so the decoder works on several symbols at once
+// Like the Huffman coder, a block may switch between tables for every group of symbols
+class Rans {
+public:
+    static const uint32_t SCALE = 1u << RANS_SCALE_BITS;
+
+    // Scales counts to frequencies summing to SCALE, every counted symbol keeps at least 1
+    // counts must not all be zero
+    static void normalize(const size_t *counts, size_t alphabetSize, uint16_t *frequencies);
+
+    // Payload bits of coding counts with frequencies, which must cover every counted symbol
+    static double cost(const size_t *counts, const uint16_t *frequencies, size_t alphabetSize);
+
+    // Frequency tables: the symbol set of every symbol some table codes, then the frequency of every
+    // present symbol for every table in turn, one byte below 128 and two bytes (high bit set) otherwise
+    static void writeFrequencies(const std::vector<std::vector<uint16_t>> &tables, std::vector<uint8_t> &out);
+    // tables must be sized to the table count; each entry is sized to alphabetSize
+    static const uint8_t *readFrequencies(const uint8_t *p, const uint8_t *end, size_t alphabetSize,
+                                          std::vector<std::vector<uint16_t>> &tables);
+
+    // Codes count symbols, symbol i with the table of selectors[i / groupSize]
+    // Appends RANS_LANES uint32 final states and the uint16 renormalization words in decoding order
+    static void encode(const uint16_t *symbols, size_t count, const uint8_t *selectors, size_t groupSize,
+                       const std::vector<std::vector<uint16_t>> &tables, std::vector<uint8_t> &out);
+
+    // Decodes count symbols from a payload written by encode into out
+    // Throws when the payload does not end exactly where the states return to their initial value
+    template <typename Symbol>
+    static void decode(const uint8_t *payload, size_t payloadSize, const uint8_t *selectors, size_t groupSize,
+                       const std::vector<std::vector<uint16_t>> &tables, Symbol *out, size_t count);
+};
+
+#endif // RANS_H
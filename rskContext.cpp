@@ -0,0 +1,31 @@
+#include "rskContext.h"
+
+RskContext::RskContext(const CompressionOptions &options) : options(options) {
+    this->options.threads = 1;
+    this->options.stats = nullptr;
+}
+
+void RskContext::compress(const uint8_t *data, size_t size, std::vector<uint8_t> &out) {
+    Compressor::CompressBuffer(data, size, options, compressScratch, out);
+}
+
+std::vector<uint8_t> RskContext::compress(const uint8_t *data, size_t size) {
+    std::vector<uint8_t> out;
+    compress(data, size, out);
+    return out;
+}
+
+void RskContext::decompress(const uint8_t *data, size_t size, std::vector<uint8_t> &out) {
+    Decompressor::DecompressBuffer(data, size, decompressScratch, out);
+}
+
+std::vector<uint8_t> RskContext::decompress(const uint8_t *data, size_t size) {
+    std::vector<uint8_t> out;
+    decompress(data, size, out);
+    return out;
+}
+
+void RskContext::release() {
+    compressScratch = Compressor::Scratch();
+    decompressScratch = Decompressor::Scratch();
+}
@@ -0,0 +1,38 @@
+#ifndef RSK_CONTEXT_H
+#define RSK_CONTEXT_H
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "compressor.h"
+#include "decompressor.h"
+
+// In-memory compression of whole buffers to and from .rsk images, without files or console output
+// The context keeps the large per-block buffers between calls: suffix array, last column, MTF, symbols,
+// inverse BWT links and block index. Small tables of every block, such as Huffman and rANS tables and
+// decoder lookups, are still allocated per call
+// A context is confined to one thread; give every thread its own
+class RskContext {
+    CompressionOptions options;
+    Compressor::Scratch compressScratch;
+    Decompressor::Scratch decompressScratch;
+
+public:
+    // options.threads and options.stats are ignored, blocks are coded on the calling thread
+    explicit RskContext(const CompressionOptions &options = CompressionOptions());
+    RskContext(const RskContext &) = delete;
+    RskContext &operator=(const RskContext &) = delete;
+
+    // Replaces out with the .rsk image of data[0..size), readable by the file tools as well
+    void compress(const uint8_t *data, size_t size, std::vector<uint8_t> &out);
+    std::vector<uint8_t> compress(const uint8_t *data, size_t size);
+
+    // Replaces out with the original bytes of the .rsk image data[0..size)
+    // Throws std::runtime_error for images that are corrupt or truncated
+    void decompress(const uint8_t *data, size_t size, std::vector<uint8_t> &out);
+    std::vector<uint8_t> decompress(const uint8_t *data, size_t size);
+
+    // Returns the retained buffers to the allocator, the context stays usable
+    void release();
+};
+
+#endif // RSK_CONTEXT_H
@@ -0,0 +1,127 @@
+#ifndef RSK_FORMAT_H
+#define RSK_FORMAT_H
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Layout of the block framed .rsk container, all integers little endian
+//
+// File header:   "RSK" | uint8 version | uint32 block size | uint32 extension length | extension
+// Block:         uint32 original size | uint32 body size | uint32 CRC32C of the original bytes | body
+// Block body:    uint32 BWT index | uint8 flags | uint8 extra BWT cursors k | k x uint32 cursor row
+//                | [uint32 coded symbol count] | uint8 table count
+//                | packed code lengths | [selectors] | HUFFMAN_STREAMS x uint32 stream bits | Huffman streams
+//                or with BLOCK_FLAG_RANS
+//                ... | uint8 table count | rANS frequencies | [selectors] | rANS coded symbols
+// BWT cursors:   the block is cut into k + 1 segments at offsets floor(j * n / (k + 1)); cursor row j is
+//                the row of the rotation starting at the end of segment j, the last segment ends at the
+//                rotation of the BWT index. The inverse BWT follows all segments at once
+// Flags:         BLOCK_FLAG_ZERO_RUNS: MTF zero runs are coded as RUNA/RUNB digits over a 257 symbol
+//                alphabet and the coded symbol count follows the flags; otherwise the 256 MTF values
+//                are coded directly, one per original byte
+//                BLOCK_FLAG_NO_BWT: the original bytes are Huffman coded as they are, without BWT, MTF
+//                or zero runs; the BWT index is 0 and there are no extra cursors
+//                BLOCK_FLAG_STORED: the flags are followed by the original bytes and nothing else;
+//                the BWT index is 0 and no other flag is set
+//                BLOCK_FLAG_RANS: the symbols are rANS coded instead of Huffman coded, with the same
+//                tables switched by the same selectors
+// Code lengths:  bitmap of the 16-symbol groups in use | uint16 symbol mask per used group
+//                | 4-bit code length per present symbol for every table in turn, high nibble first
+//                Codes are canonical, a block with a single symbol carries no coded data
+// Huffman streams: the g symbol groups are split into HUFFMAN_STREAMS runs, stream k codes groups
+//                huffmanStreamStart(g, k) up to huffmanStreamStart(g, k + 1); every stream is MSB first and
+//                zero padded to a whole byte, and the streams follow each other in order
+//                Decoders advance all streams at once, so their lookups do not wait on each other
+// rANS frequencies: the symbol set as above, then the frequency of every present symbol for every
+//                table in turn, one byte below 128 and two bytes (high bit set) otherwise; every table
+//                sums to 1 << RANS_SCALE_BITS
+// rANS coded:    RANS_LANES x uint32 final state | uint16 renormalization words in decoding order;
+//                symbol i is coded by state i % RANS_LANES
+// Selectors:     only with more than one table: the table of every group of HUFFMAN_GROUP_SIZE
+//                coded symbols, move to front coded and written in unary (n one bits, then a zero),
+//                MSB first and zero padded to a whole byte
+// End of blocks: uint32 0
+// Block index:   uint32 block count | block count x (uint64 offset, uint32 compressed size, uint32 original size)
+// Footer:        uint64 block index offset | uint32 CRC32C of all original bytes | "RSKI"
+//
+// Archive:       "RSA" | uint8 version | uint32 block size | uint32 0 | blocks, end of blocks, block index
+//                and footer as above | member index | archive footer
+//                The blocks hold the members back to back; a member of at least a block starts a new block,
+//                smaller ones share blocks. The block frames, block index and footer are laid out as in a
+//                .rsk file, but the header magic differs, so -d and -t do not take archives
+// Member index:  uint32 member count | member count x (uint16 name length | name | uint64 offset
+//                | uint64 size | uint32 CRC32C), offset is where the member starts in the member data
+// Archive footer: uint64 member index offset | uint32 CRC32C of the member index | "RSKA"
+//
+// Every block is coded independently, so blocks can be compressed and decompressed in parallel
+// The block index at the end of the file lets readers locate every block without parsing the ones before it
+// The file CRC equals the block CRCs combined in order, so it is checked without a second pass over the data
+
+#define RSK_MAGIC "RSK"
+#define RSK_VERSION 11
+#define RSK_FILE_HEADER_SIZE 12
+#define MIN_BLOCK_SIZE (100 * 1024)
+#define MAX_BLOCK_SIZE (8 * 1024 * 1024)
+#define DEFAULT_BLOCK_SIZE (1024 * 1024)
+#define RSK_INDEX_MAGIC "RSKI"
+#define RSK_ARCHIVE_MAGIC "RSA"
+#define RSK_ARCHIVE_INDEX_MAGIC "RSKA"
+#define RSK_ARCHIVE_FOOTER_SIZE 16
+#define MAX_MEMBER_NAME_LENGTH 4096
+#define BLOCK_FRAME_HEADER_SIZE 12
+#define BLOCK_INDEX_ENTRY_SIZE 16
+#define RSK_FOOTER_SIZE 16
+#define BLOCK_FLAG_ZERO_RUNS 0x01
+#define BLOCK_FLAG_NO_BWT 0x02
+#define BLOCK_FLAG_STORED 0x04
+#define BLOCK_FLAG_RANS 0x08
+#define STORED_BLOCK_HEADER_SIZE 5
+#define HUFFMAN_GROUP_SIZE 50
+#define MAX_HUFFMAN_TABLES 6
+#define HUFFMAN_STREAMS 4
+#define MAX_BWT_CURSORS 8
+
+// Entry of the block index stored in the trailer
+struct BlockIndexEntry {
+    uint64_t offset;          // File offset of the block frame
+    uint32_t compressedSize;  // Frame size, including the frame header
+    uint32_t originalSize;    // Uncompressed bytes in the block
+    uint32_t crc;             // CRC32C of the uncompressed bytes, stored in the block frame
+};
+
+// First symbol group coded by Huffman stream k of a block with groups symbol groups
+inline size_t huffmanStreamStart(size_t groups, size_t stream) {
+    return groups * stream / HUFFMAN_STREAMS;
+}
+
+inline void putU16(std::vector<uint8_t> &out, uint16_t value) {
+    out.push_back(static_cast<uint8_t>(value));
+    out.push_back(static_cast<uint8_t>(value >> 8));
+}
+
+inline void putU32(std::vector<uint8_t> &out, uint32_t value) {
+    for (int shift = 0; shift < 32; shift += 8) out.push_back(static_cast<uint8_t>(value >> shift));
+}
+
+inline void putU64(std::vector<uint8_t> &out, uint64_t value) {
+    for (int shift = 0; shift < 64; shift += 8) out.push_back(static_cast<uint8_t>(value >> shift));
+}
+
+inline void patchU32(std::vector<uint8_t> &out, size_t pos, uint32_t value) {
+    for (int i = 0; i < 4; i++) out[pos + i] = static_cast<uint8_t>(value >> (8 * i));
+}
+
+inline uint16_t getU16(const uint8_t *p) {
+    return static_cast<uint16_t>(p[0] | (p[1] << 8));
+}
+
+inline uint32_t getU32(const uint8_t *p) {
+    return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) |
+           (static_cast<uint32_t>(p[2]) << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+inline uint64_t getU64(const uint8_t *p) {
+    return static_cast<uint64_t>(getU32(p)) | (static_cast<uint64_t>(getU32(p + 4)) << 32);
+}
+
+#endif // RSK_FORMAT_H
@@ -0,0 +1,170 @@
+#include "suffixArray.h"
+#include <vector>
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+namespace {
+
+// Byte string followed by a copy of itself and a virtual sentinel
+// Symbols are shifted up by one so the sentinel can take the unique smallest value 0
+template <typename Index>
+struct DoubledText {
+    const uint8_t *text;
+    Index n;
+
+    Index operator[](Index i) const {
+        if (i >= 2 * n) return 0;
+        return static_cast<Index>(text[i < n ? i : i - n]) + 1;
+    }
+};
+
+// Reduced string of LMS substring names, stored in the tail of the suffix array
+template <typename Index>
+struct NameText {
+    const Index *names;
+
+    Index operator[](Index i) const { return names[i]; }
+};
+
+// One bit per suffix: 1 for S-type, 0 for L-type
+class SuffixTypes {
+    std::vector<uint64_t> bits;
+
+public:
+    explicit SuffixTypes(size_t n) : bits(n / 64 + 1, 0) {}
+
+    bool get(size_t i) const { return (bits[i >> 6] >> (i & 63)) & 1; }
+    void set(size_t i, bool sType) {
+        if (sType) bits[i >> 6] |= (1ULL << (i & 63));
+        else bits[i >> 6] &= ~(1ULL << (i & 63));
+    }
+    // Leftmost S-type position of an S-run
+    bool isLMS(size_t i) const { return i > 0 && get(i) && !get(i - 1); }
+};
+
+// Find the start or end of each bucket
+template <typename Text, typename Index>
+void getBuckets(const Text &s, Index n, Index *bkt, Index K, bool end) {
+    std::fill(bkt, bkt + K + 1, 0);
+    for (Index i = 0; i < n; i++) bkt[s[i]]++;
+    Index sum = 0;
+    for (Index i = 0; i <= K; i++) {
+        sum += bkt[i];
+        bkt[i] = end ? sum : sum - bkt[i];
+    }
+}
+
+// Induce the order of L-type suffixes from the sorted LMS suffixes
+template <typename Text, typename Index>
+void induceL(const SuffixTypes &t, Index *SA, const Text &s, Index n, Index *bkt, Index K) {
+    getBuckets(s, n, bkt, K, false);
+    for (Index i = 0; i < n; i++) {
+        Index j = SA[i] - 1;
+        if (j >= 0 && !t.get(j)) SA[bkt[s[j]]++] = j;
+    }
+}
+
+// Induce the order of S-type suffixes from the sorted L-type suffixes
+template <typename Text, typename Index>
+void induceS(const SuffixTypes &t, Index *SA, const Text &s, Index n, Index *bkt, Index K) {
+    getBuckets(s, n, bkt, K, true);
+    for (Index i = n - 1; i >= 0; i--) {
+        Index j = SA[i] - 1;
+        if (j >= 0 && t.get(j)) SA[--bkt[s[j]]] = j;
+    }
+}
+
+// Suffix array of s[0..n) over the alphabet {0..K}
+// s[n - 1] must be the unique smallest symbol and n >= 2
+template <typename Text, typename Index>
+void sais(const Text &s, Index *SA, Index n, Index K) {
+    SuffixTypes t(n);
+    t.set(n - 2, false);
+    t.set(n - 1, true);
+    for (Index i = n - 3; i >= 0; i--)
+        t.set(i, s[i] < s[i + 1] || (s[i] == s[i + 1] && t.get(i + 1)));
+
+    // Stage 1: sort the LMS substrings by a single induce pass
+    std::vector<Index> bkt(K + 1);
+    getBuckets(s, n, bkt.data(), K, true);
+    std::fill(SA, SA + n, -1);
+    for (Index i = 1; i < n; i++)
+        if (t.isLMS(i)) SA[--bkt[s[i]]] = i;
+    induceL(t, SA, s, n, bkt.data(), K);
+    induceS(t, SA, s, n, bkt.data(), K);
+
+    // Compact the sorted LMS substrings into the first n1 slots (2 * n1 <= n)
+    Index n1 = 0;
+    for (Index i = 0; i < n; i++)
+        if (t.isLMS(SA[i])) SA[n1++] = SA[i];
+
+    // Name the LMS substrings, equal substrings share a name
+    std::fill(SA + n1, SA + n, -1);
+    Index name = 0, prev = -1;
+    for (Index i = 0; i < n1; i++) {
+        Index pos = SA[i];
+        bool diff = false;
+        for (Index d = 0; d < n; d++) {
+            if (prev == -1 || s[pos + d] != s[prev + d] || t.get(pos + d) != t.get(prev + d)) {
+                diff = true;
+                break;
+            }
+            if (d > 0 && (t.isLMS(pos + d) || t.isLMS(prev + d))) break;
+        }
+        if (diff) {
+            name++;
+            prev = pos;
+        }
+        SA[n1 + pos / 2] = name - 1;
+    }
+    for (Index i = n - 1, j = n - 1; i >= n1; i--)
+        if (SA[i] >= 0) SA[j--] = SA[i];
+
+    // Stage 2: sort the reduced string, recursing only while names are not unique
+    Index *SA1 = SA, *s1 = SA + n - n1;
+    if (name < n1) sais(NameText<Index>{s1}, SA1, n1, name - 1);
+    else for (Index i = 0; i < n1; i++) SA1[s1[i]] = i;
+
+    // Stage 3: induce the full suffix array from the sorted LMS suffixes
+    getBuckets(s, n, bkt.data(), K, true);
+    for (Index i = 1, j = 0; i < n; i++)
+        if (t.isLMS(i)) s1[j++] = i;
+    for (Index i = 0; i < n1; i++) SA1[i] = s1[SA1[i]];
+    std::fill(SA + n1, SA + n, -1);
+    for (Index i = n1 - 1; i >= 0; i--) {
+        Index j = SA[i];
+        SA[i] = -1;
+        SA[--bkt[s[j]]] = j;
+    }
+    induceL(t, SA, s, n, bkt.data(), K);
+    induceS(t, SA, s, n, bkt.data(), K);
+}
+
+} // namespace
+
+template <typename Index>
+void SuffixArray::sortRotationsImpl(const uint8_t *text, size_t n, std::vector<Index> &order) {
+    order.clear();
+    if (n == 0) return;
+    if (n > static_cast<size_t>((std::numeric_limits<Index>::max() - 1) / 2))
+        throw std::runtime_error("Input too large for suffix array index type");
+
+    // Every rotation is a prefix of a suffix of text+text that starts in the first copy
+    Index total = static_cast<Index>(2 * n + 1);
+    order.resize(total);
+    sais(DoubledText<Index>{text, static_cast<Index>(n)}, order.data(), total, static_cast<Index>(256));
+
+    size_t k = 0;
+    for (Index i = 0; i < total; i++)
+        if (order[i] < static_cast<Index>(n)) order[k++] = order[i];
+    order.resize(n);
+}
+
+void SuffixArray::sortRotations(const uint8_t *text, size_t n, std::vector<int32_t> &order) {
+    sortRotationsImpl(text, n, order);
+}
+
+void SuffixArray::sortRotations(const uint8_t *text, size_t n, std::vector<int64_t> &order) {
+    sortRotationsImpl(text, n, order);
+}
@@ -0,0 +1,23 @@
+#ifndef SUFFIX_ARRAY_H
+#define SUFFIX_ARRAY_H
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Linear time suffix sorting by induced sorting (SA-IS, Nong, Zhang & Chan 2009)
+// Only the suffix array and a bit vector of suffix types are allocated per level,
+// the reduced problem is solved inside the suffix array itself
+class SuffixArray {
+    template <typename Index>
+    static void sortRotationsImpl(const uint8_t *text, size_t n, std::vector<Index> &order);
+
+public:
+    // Sorts the cyclic rotations of text[0..n) by sorting the suffixes of text+text
+    // On return the first n entries of order hold the rotation start offsets in
+    // ascending order; order is used as scratch space and grows to 2n + 1 entries
+    // Equal rotations (periodic input) are ordered by descending start offset
+    static void sortRotations(const uint8_t *text, size_t n, std::vector<int32_t> &order);
+    static void sortRotations(const uint8_t *text, size_t n, std::vector<int64_t> &order);
+};
+
+#endif // SUFFIX_ARRAY_H
@@ -0,0 +1,73 @@
+#include "threadPool.h"
+#include <algorithm>
+
+// Index of the calling thread's queue within its pool, or none outside a pool
+static thread_local const ThreadPool *currentPool = nullptr;
+static thread_local size_t currentQueue = 0;
+
+ThreadPool::ThreadPool(size_t threadCount) {
+    threadCount = std::max<size_t>(threadCount, 1);
+    queues.reserve(threadCount);
+    for (size_t i = 0; i < threadCount; i++) queues.push_back(std::unique_ptr<Queue>(new Queue()));
+    workers.reserve(threadCount);
+    for (size_t i = 0; i < threadCount; i++)
+        workers.emplace_back(&ThreadPool::workerLoop, this, i);
+}
+
+// Drains the queues before joining, so every submitted future becomes ready
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    available.notify_all();
+    for (std::thread &worker : workers) worker.join();
+}
+
+size_t ThreadPool::defaultThreadCount() {
+    unsigned hardware = std::thread::hardware_concurrency();
+    return hardware ? hardware : 1;
+}
+
+void ThreadPool::push(std::function<void()> task) {
+    size_t target = (currentPool == this) ? currentQueue : nextQueue++ % queues.size();
+    {
+        std::lock_guard<std::mutex> lock(queues[target]->mutex);
+        queues[target]->tasks.push_back(std::move(task));
+    }
+    // Counted under the pool mutex, so a worker about to sleep cannot miss it
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        queued++;
+    }
+    available.notify_one();
+}
+
+// Own queue first, then the others starting with the next one over
+bool ThreadPool::pop(size_t self, std::function<void()> &task) {
+    for (size_t i = 0; i < queues.size(); i++) {
+        Queue &queue = *queues[(self + i) % queues.size()];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.tasks.empty()) continue;
+        task = std::move(queue.tasks.front());
+        queue.tasks.pop_front();
+        queued--;
+        return true;
+    }
+    return false;
+}
+
+void ThreadPool::workerLoop(size_t self) {
+    currentPool = this;
+    currentQueue = self;
+    for (;;) {
+        std::function<void()> task;
+        if (pop(self, task)) {
+            task();
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(mutex);
+        available.wait(lock, [this] { return stopping || queued > 0; });
+        if (stopping && queued <= 0) return;
+    }
+}
@@ -0,0 +1,58 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed size pool of worker threads, each with a task queue of its own
+// Tasks submitted from outside are dealt to the queues in turn, tasks submitted by a worker go to
+// its own queue; a worker whose queue runs dry steals from the others, oldest task first
+// Results and exceptions are handed back through std::future
+class ThreadPool {
+    struct Queue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> workers;
+    std::atomic<size_t> nextQueue{0};
+
+    // Sleeping workers wait for queued to become positive
+    // A task can be taken before push counts it, so queued may briefly drop below zero
+    std::mutex mutex;
+    std::condition_variable available;
+    std::atomic<std::ptrdiff_t> queued{0};
+    bool stopping = false;
+
+    void push(std::function<void()> task);
+    bool pop(size_t self, std::function<void()> &task);
+    void workerLoop(size_t self);
+
+public:
+    explicit ThreadPool(size_t threadCount);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    // Number of hardware threads, at least 1
+    static size_t defaultThreadCount();
+    size_t size() const { return workers.size(); }
+
+    template <typename F>
+    auto submit(F task) -> std::future<decltype(task())> {
+        auto packaged = std::make_shared<std::packaged_task<decltype(task())()>>(std::move(task));
+        std::future<decltype(task())> result = packaged->get_future();
+        push([packaged]() { (*packaged)(); });
+        return result;
+    }
+};
+
+#endif // THREAD_POOL_H
@@ -0,0 +1,69 @@
+#include "zeroRunLength.h"
+#include <cstring>
+#include <stdexcept>
+
+const uint16_t ZeroRunLength::RUNA;
+const uint16_t ZeroRunLength::RUNB;
+const size_t ZeroRunLength::ALPHABET_SIZE;
+
+// Digits of a run length, each digit d adds (d + 1) << position
+static inline void putRun(std::vector<uint16_t> &out, size_t run) {
+    while (run > 0) {
+        run--;
+        out.push_back((run & 1) ? ZeroRunLength::RUNB : ZeroRunLength::RUNA);
+        run >>= 1;
+    }
+}
+
+std::vector<uint16_t> ZeroRunLength::encode(const uint8_t *mtf, size_t n) {
+    std::vector<uint16_t> out;
+    ZeroRunLength::encode(mtf, n, out);
+    return out;
+}
+
+void ZeroRunLength::encode(const uint8_t *mtf, size_t n, std::vector<uint16_t> &out) {
+    out.clear();
+    out.reserve(n / 2 + 16);
+
+    size_t run = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (mtf[i] == 0) {
+            run++;
+            continue;
+        }
+        putRun(out, run);
+        run = 0;
+        out.push_back(static_cast<uint16_t>(mtf[i] + 1));
+    }
+    putRun(out, run);
+}
+
+void ZeroRunLength::decode(const uint16_t *in, size_t n, uint8_t *out, size_t outSize) {
+    uint8_t *end = out + outSize;
+    size_t run = 0;
+    int position = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        uint16_t symbol = in[i];
+        if (symbol <= RUNB) {
+            // Runs cannot be longer than the block, which also keeps the shift in range
+            if (position >= 32) throw std::runtime_error("Corrupt block: zero run too long");
+            run += static_cast<size_t>(symbol + 1) << position++;
+            continue;
+        }
+        if (run) {
+            if (run > static_cast<size_t>(end - out)) throw std::runtime_error("Corrupt block: zero run exceeds block size");
+            std::memset(out, 0, run);
+            out += run;
+            run = 0;
+            position = 0;
+        }
+        if (out == end) throw std::runtime_error("Corrupt block: zero run coded data exceeds block size");
+        if (symbol >= ALPHABET_SIZE) throw std::runtime_error("Corrupt block: symbol outside the alphabet");
+        *out++ = static_cast<uint8_t>(symbol - 1);
+    }
+    if (run > static_cast<size_t>(end - out)) throw std::runtime_error("Corrupt block: zero run exceeds block size");
+    std::memset(out, 0, run);
+    out += run;
+    if (out != end) throw std::runtime_error("Corrupt block: zero run coded data shorter than block size");
+}
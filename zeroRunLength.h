@@ -0,0 +1,24 @@
+#ifndef ZERO_RUN_LENGTH_H
+#define ZERO_RUN_LENGTH_H
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Zero run coding of MTF output ahead of the Huffman coder
+// A run of zeros becomes its length in bijective base 2, least significant digit first,
+// written with the digits RUNA (1) and RUNB (2); any other MTF value v becomes v + 1
+class ZeroRunLength {
+public:
+    static const uint16_t RUNA = 0;
+    static const uint16_t RUNB = 1;
+    // Symbols used by the coded stream: RUNA, RUNB and MTF values 1..255 shifted up by one
+    static const size_t ALPHABET_SIZE = 257;
+
+    static std::vector<uint16_t> encode(const uint8_t *mtf, size_t n);
+    // Same, replacing the contents of out so its capacity is reused
+    static void encode(const uint8_t *mtf, size_t n, std::vector<uint16_t> &out);
+    // Expands in[0..n) into exactly outSize MTF values, throwing if the symbols do not add up to it
+    static void decode(const uint16_t *in, size_t n, uint8_t *out, size_t outSize);
+};
+
+#endif // ZERO_RUN_LENGTH_H